@@ -0,0 +1,99 @@
+﻿#pragma once
+#include <Eigen/Dense>
+#include "Varyings.h"
+
+using namespace Eigen;
+
+// 几何阶段的裁剪 (齐次裁剪空间，透视除法之前)
+//   1. 三个顶点都在视锥同一个面外面 -> 整个三角形剔除
+//   2. 跨过近平面 (w 接近 0 或为负) -> 真正裁掉，否则透视除法后坐标会爆掉/翻转
+//   3. 左右上下只在超出保护带 (guard band) 时才裁：保护带以内交给光栅化的包围盒裁剪，
+//      既省掉大部分裁剪，又保证屏幕坐标不会大到让包围盒失控
+// 所有属性在裁剪空间里都是线性的，所以交点处直接线性插值即可
+namespace Clipper {
+
+    struct Vertex {
+        Vector4f clip; // 裁剪空间坐标 (MVP 之后)
+        float varying[VARYING_COUNT];
+    };
+
+    // 保护带：NDC 的 x/y 在 [-GUARD_BAND, GUARD_BAND] 之内都不裁
+    // 700 像素的画面对应 ±5600 像素左右，远在定点数范围 (TriangleSetup::FIXED_RANGE_BITS) 之内
+    static const float GUARD_BAND = 16.0f;
+
+    // 一个三角形最多被 5 个平面各切掉一个角，多边形最多 3 + 5 个顶点
+    static const int MAX_VERTS = 8;
+
+    // 平面方程 d(v) >= 0 为内侧
+    enum Plane { NEAR_PLANE, LEFT, RIGHT, BOTTOM, TOP, PLANE_COUNT };
+
+    inline float distance(const Vector4f& p, int plane, float band) {
+        switch (plane) {
+        case NEAR_PLANE: return p.z() + p.w();
+        case LEFT:       return p.x() + band * p.w();
+        case RIGHT:      return band * p.w() - p.x();
+        case BOTTOM:     return p.y() + band * p.w();
+        default:         return band * p.w() - p.y();
+        }
+    }
+
+    inline Vertex lerp(const Vertex& a, const Vertex& b, float t) {
+        Vertex v;
+        v.clip = a.clip + (b.clip - a.clip) * t;
+        for (int k = 0; k < VARYING_COUNT; k++) {
+            v.varying[k] = a.varying[k] + (b.varying[k] - a.varying[k]) * t;
+        }
+        return v;
+    }
+
+    // Sutherland-Hodgman：用一个平面切多边形，返回新的顶点数
+    inline int clip_polygon(const Vertex* in, int count, Vertex* out, int plane) {
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            const Vertex& a = in[i];
+            const Vertex& b = in[(i + 1) % count];
+            float da = distance(a.clip, plane, GUARD_BAND);
+            float db = distance(b.clip, plane, GUARD_BAND);
+
+            if (da >= 0) out[n++] = a;
+            if ((da >= 0) != (db >= 0)) out[n++] = lerp(a, b, da / (da - db));
+        }
+        return n;
+    }
+
+    // 裁剪一个三角形，结果是一个凸多边形 (按扇形拆成 n - 2 个三角形)
+    // 返回顶点数，0 表示整个三角形被剔除
+    inline int clip_triangle(const Vertex in[3], Vertex out[MAX_VERTS]) {
+        // 1. 视锥剔除 (用真正的视锥，不带保护带)；远平面也算上
+        unsigned outside_all = ~0u, outside_any = 0;
+        for (int i = 0; i < 3; i++) {
+            const Vector4f& p = in[i].clip;
+            unsigned code = 0;
+            for (int plane = 0; plane < PLANE_COUNT; plane++) {
+                if (distance(p, plane, 1.0f) < 0) code |= 1u << plane;
+            }
+            if (p.w() - p.z() < 0) code |= 1u << PLANE_COUNT; // 远平面
+            outside_all &= code;
+        }
+        if (outside_all) return 0;
+
+        // 2. 需要真正裁剪的平面：近平面 + 超出保护带的侧面
+        for (int i = 0; i < 3; i++) {
+            for (int plane = 0; plane < PLANE_COUNT; plane++) {
+                if (distance(in[i].clip, plane, GUARD_BAND) < 0) outside_any |= 1u << plane;
+            }
+        }
+
+        out[0] = in[0]; out[1] = in[1]; out[2] = in[2];
+        if (!outside_any) return 3;
+
+        Vertex tmp[MAX_VERTS];
+        int count = 3;
+        for (int plane = 0; plane < PLANE_COUNT && count > 0; plane++) {
+            if (!(outside_any & (1u << plane))) continue;
+            count = clip_polygon(out, count, tmp, plane);
+            for (int i = 0; i < count; i++) out[i] = tmp[i];
+        }
+        return count >= 3 ? count : 0;
+    }
+}
@@ -1,13 +1,36 @@
 ﻿#include "LoadModel.h"
 #include <iostream>
+#include <iomanip>
 #include <map>
+#include <unordered_map>
+#include <cstring>
 #include <algorithm> // 用于 transform 转小写
+#include <limits>
+#include <cmath>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
 namespace LoadModel {
 
+    // 顶点焊接的键：位置、UV、法线按位完全相同的角点合并成一个顶点
+    struct VertexKey {
+        float v[8];
+        bool operator==(const VertexKey& o) const { return std::memcmp(v, o.v, sizeof(v)) == 0; }
+    };
+    struct VertexKeyHash {
+        size_t operator()(const VertexKey& k) const {
+            uint32_t bits[8];
+            std::memcpy(bits, k.v, sizeof(bits));
+            uint64_t h = 14695981039346656037ull; // FNV-1a，按 32 位字
+            for (uint32_t b : bits) {
+                h ^= b;
+                h *= 1099511628211ull;
+            }
+            return (size_t)h;
+        }
+    };
+
     std::string clean_path(std::string path) {
         if (path.empty()) return "";
         path.erase(0, path.find_first_not_of(" \t\n\r"));
@@ -17,6 +40,160 @@ namespace LoadModel {
         return path;
     }
 
+    float compute_acmr(const SubMesh& mesh, int cache_size) {
+        size_t tri_count = mesh.indices.size() / 3;
+        if (tri_count == 0) return 0.0f;
+
+        // FIFO：时间戳在最近 cache_size 次未命中以内的顶点还在缓存里
+        std::vector<size_t> stamp(mesh.vertices.size(), 0);
+        size_t misses = 0;
+        for (uint32_t v : mesh.indices) {
+            if (stamp[v] == 0 || misses - stamp[v] >= (size_t)cache_size) {
+                misses++;
+                stamp[v] = misses;
+            }
+        }
+        return (float)misses / tri_count;
+    }
+
+    // Tipsify (Sander, Nehab, Barczak 2007)：每次选一个 "扇心" 顶点，把它剩下的三角形全部输出；
+    // 下一个扇心从刚输出的顶点里挑还在缓存里、剩余三角形又不会把自己挤出缓存的那个，
+    // 都不合适时从死胡同栈里找最近输出过的，再不行按编号顺序找。整体线性时间
+    void optimize_vertex_cache(SubMesh& mesh, int cache_size) {
+        const size_t vertex_count = mesh.vertices.size();
+        const size_t tri_count = mesh.indices.size() / 3;
+        if (tri_count == 0) return;
+        const std::vector<uint32_t>& in = mesh.indices;
+
+        // 1. 顶点 -> 三角形邻接表 (CSR)
+        std::vector<int> live(vertex_count, 0);      // 还没输出的相邻三角形数
+        for (uint32_t v : in) live[v]++;
+        std::vector<uint32_t> adj_offset(vertex_count + 1, 0);
+        for (size_t v = 0; v < vertex_count; v++) adj_offset[v + 1] = adj_offset[v] + live[v];
+        std::vector<uint32_t> adj(in.size());
+        std::vector<uint32_t> adj_end(adj_offset.begin(), adj_offset.end() - 1);
+        for (size_t i = 0; i < in.size(); i++) adj[adj_end[in[i]]++] = (uint32_t)(i / 3);
+
+        // 2. 模拟缓存贪心输出
+        std::vector<size_t> cache_time(vertex_count, 0);
+        std::vector<char> emitted(tri_count, 0);
+        std::vector<uint32_t> dead_end;    // 输出过的顶点 (栈)
+        std::vector<uint32_t> candidates;  // 这一轮刚输出的顶点
+        std::vector<uint32_t> out;
+        out.reserve(in.size());
+        size_t time = cache_size + 1;
+        size_t cursor = 1;                 // 按编号找下一个还有三角形的顶点
+        int fan = 0;
+        std::vector<uint32_t> cluster_start = { 0 }; // 每个簇的第一个三角形
+
+        while (fan >= 0) {
+            candidates.clear();
+            for (uint32_t k = adj_offset[fan]; k < adj_offset[fan + 1]; k++) {
+                uint32_t t = adj[k];
+                if (emitted[t]) continue;
+                emitted[t] = 1;
+                for (int j = 0; j < 3; j++) {
+                    uint32_t v = in[t * 3 + j];
+                    out.push_back(v);
+                    dead_end.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (time - cache_time[v] > (size_t)cache_size) {
+                        cache_time[v] = time;
+                        time++;
+                    }
+                }
+            }
+
+            // 下一个扇心：优先选在缓存里待得最久、但把剩余三角形输出完之前不会被挤出去的
+            fan = -1;
+            size_t best = 0;
+            for (uint32_t v : candidates) {
+                if (live[v] <= 0) continue;
+                size_t priority = 0;
+                if (time - cache_time[v] + 2 * live[v] <= (size_t)cache_size) priority = time - cache_time[v];
+                if (fan < 0 || priority > best) {
+                    best = priority;
+                    fan = (int)v;
+                }
+            }
+            if (fan >= 0) continue;
+
+            // 缓存断开的地方是一个簇的边界
+            if (cluster_start.back() != out.size() / 3) cluster_start.push_back((uint32_t)(out.size() / 3));
+            while (!dead_end.empty()) {
+                uint32_t v = dead_end.back();
+                dead_end.pop_back();
+                if (live[v] > 0) {
+                    fan = (int)v;
+                    break;
+                }
+            }
+            while (fan < 0 && cursor < vertex_count) {
+                if (live[cursor] > 0) fan = (int)cursor;
+                cursor++;
+            }
+        }
+
+        // 3. 降低 overdraw：簇按 "离网格中心多远、朝不朝外" 排序 (和视角无关)，
+        // 朝外的外围部分先画，容易挡住别的簇，后画的被 Hi-Z / 深度测试提前剔掉。簇内顺序不变，ACMR 几乎不受影响
+        cluster_start.push_back((uint32_t)tri_count);
+        const size_t cluster_count = cluster_start.size() - 1;
+        if (cluster_count > 1) {
+            Vector3f mesh_center = Vector3f::Zero();
+            for (const Vector3f& p : mesh.vertices) mesh_center += p;
+            mesh_center /= (float)vertex_count;
+
+            std::vector<std::pair<float, uint32_t>> order(cluster_count);
+            for (size_t c = 0; c < cluster_count; c++) {
+                Vector3f center = Vector3f::Zero(), normal = Vector3f::Zero();
+                float area = 0.0f;
+                for (uint32_t t = cluster_start[c]; t < cluster_start[c + 1]; t++) {
+                    const Vector3f& a = mesh.vertices[out[t * 3]];
+                    const Vector3f& b = mesh.vertices[out[t * 3 + 1]];
+                    const Vector3f& d = mesh.vertices[out[t * 3 + 2]];
+                    Vector3f n = (b - a).cross(d - a); // 长度 = 面积 * 2
+                    float w = n.norm();
+                    center += (a + b + d) * (w / 3.0f);
+                    normal += n;
+                    area += w;
+                }
+                if (area > 0.0f) center /= area;
+                order[c] = { -(center - mesh_center).dot(normal.normalized()), (uint32_t)c };
+            }
+            std::stable_sort(order.begin(), order.end(),
+                [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) { return a.first < b.first; });
+
+            std::vector<uint32_t> sorted;
+            sorted.reserve(out.size());
+            for (const auto& entry : order) {
+                sorted.insert(sorted.end(), out.begin() + cluster_start[entry.second] * 3, out.begin() + cluster_start[entry.second + 1] * 3);
+            }
+            out.swap(sorted);
+        }
+
+        // 4. 顶点按第一次被引用的顺序重新编号，顶点数据跟着搬
+        std::vector<uint32_t> remap(vertex_count, UINT32_MAX);
+        std::vector<Vector3f> vertices, normals;
+        std::vector<Vector2f> texcoords;
+        vertices.reserve(vertex_count);
+        normals.reserve(vertex_count);
+        texcoords.reserve(vertex_count);
+        for (uint32_t& v : out) {
+            if (remap[v] == UINT32_MAX) {
+                remap[v] = (uint32_t)vertices.size();
+                vertices.push_back(mesh.vertices[v]);
+                texcoords.push_back(mesh.texcoords[v]);
+                normals.push_back(mesh.normals[v]);
+            }
+            v = remap[v];
+        }
+        mesh.vertices.swap(vertices);
+        mesh.texcoords.swap(texcoords);
+        mesh.normals.swap(normals);
+        mesh.indices.swap(out);
+    }
+
     bool load_obj(const std::string& path, const std::string& base_dir, Model& model) {
         tinyobj::attrib_t attrib;
         std::vector<tinyobj::shape_t> shapes;
@@ -32,6 +209,7 @@ namespace LoadModel {
 
         // --- 🟢 步骤 1：预处理材质，标记哪些 ID 是脸 ---
         std::vector<bool> material_is_face_flags;
+        std::vector<bool> material_double_sided_flags;
 
         std::cout << "------ Material Inspection ------" << std::endl;
 
@@ -76,17 +254,38 @@ namespace LoadModel {
                 is_face = true;
             }
 
+            // 1.3 双面材质：MTL 里写了 "double_sided 1" 就以它为准，
+            // 否则按名字猜：头发(kami)、裙子、缎带、睫毛(matsuge)、眉毛(mayu)、眼镜这类薄片两面都看得到
+            bool double_sided = false;
+            auto ds = mat.unknown_parameter.find("double_sided");
+            if (ds != mat.unknown_parameter.end()) {
+                double_sided = ds->second != "0";
+            }
+            else {
+                for (const char* key : { "hair", "kami", "skirt", "ribbon", "matsuge", "mayu", "megane", "glass" }) {
+                    if (mat_name_lower.find(key) != std::string::npos || tex_name_lower.find(key) != std::string::npos) {
+                        double_sided = true;
+                    }
+                }
+            }
+
             // 🔴 打印出来给你看，到底是哪个材质被选中了
             std::cout << "ID: " << material_is_face_flags.size()
                 << " | Name: [" << mat_name << "] "
                 << " | Tex: [" << tex_name << "] "
-                << " -> " << (is_face ? "[FACE]" : "[Body]") << std::endl;
+                << " -> " << (is_face ? "[FACE]" : "[Body]")
+                << (double_sided ? " [Double-sided]" : "") << std::endl;
 
             material_is_face_flags.push_back(is_face);
+            material_double_sided_flags.push_back(double_sided);
         }
         std::cout << "---------------------------------" << std::endl;
-        // --- 🟢 步骤 2：按材质拆分网格 (不要在这里过滤！) ---
+        // --- 🟢 步骤 2：按材质拆分网格 (不要在这里过滤！)，同时焊接重复顶点 ---
+        // OBJ 里每个角点都单独展开的话，共享顶点要存 (和变换) 六次左右；
+        // 这里每个部件一张哈希表，相同的 (位置, UV, 法线) 只存一次，三角形改用下标引用
         std::map<int, SubMesh> sorted_meshes;
+        std::map<int, std::unordered_map<VertexKey, uint32_t, VertexKeyHash>> weld_tables;
+        size_t corner_count = 0;
 
         for (const auto& shape : shapes) {
             size_t index_offset = 0;
@@ -98,6 +297,8 @@ namespace LoadModel {
                 }
 
                 // 只要有材质ID，就无条件加入对应的桶，千万不要写 if(is_face)
+                SubMesh& mesh = sorted_meshes[mat_id];
+                auto& weld = weld_tables[mat_id];
 
                 for (size_t v = 0; v < 3; v++) {
                     tinyobj::index_t idx = shape.mesh.indices[index_offset + v];
@@ -121,15 +322,23 @@ namespace LoadModel {
                         norm.z() = attrib.normals[3 * idx.normal_index + 2];
                     }
 
-                    sorted_meshes[mat_id].vertices.push_back(vert);
-                    sorted_meshes[mat_id].texcoords.push_back(tex);
-                    sorted_meshes[mat_id].normals.push_back(norm);
+                    VertexKey key = { { vert.x(), vert.y(), vert.z(), tex.x(), tex.y(), norm.x(), norm.y(), norm.z() } };
+                    auto found = weld.emplace(key, (uint32_t)mesh.vertices.size());
+                    if (found.second) {
+                        mesh.vertices.push_back(vert);
+                        mesh.texcoords.push_back(tex);
+                        mesh.normals.push_back(norm);
+                    }
+                    mesh.indices.push_back(found.first->second);
                 }
                 index_offset += 3;
+                corner_count += 3;
             }
         }
+        weld_tables.clear();
 
-        // --- 🟢 步骤 3：组装最终模型，并打上 is_face 标记 ---
+        // --- 🟢 步骤 3：组装最终模型，并打上 is_face / double_sided 标记 ---
+        size_t unique_count = 0;
         for (auto& pair : sorted_meshes) {
             int mat_id = pair.first;
             SubMesh& mesh = pair.second;
@@ -139,14 +348,53 @@ namespace LoadModel {
             // 查表：这个材质ID是不是脸？
             if (mat_id >= 0 && mat_id < material_is_face_flags.size()) {
                 mesh.is_face = material_is_face_flags[mat_id];
+                mesh.double_sided = material_double_sided_flags[mat_id];
             }
             else {
+                // 没有材质的部件不知道绕序靠不靠谱，保守起见按双面画
                 mesh.is_face = false;
+                mesh.double_sided = true;
             }
 
+            // 顶点缓存优化，打印前后的 ACMR
+            float acmr_before = compute_acmr(mesh);
+            optimize_vertex_cache(mesh);
+            float acmr_after = compute_acmr(mesh);
+            std::cout << "SubMesh " << model.meshes.size() << ": " << mesh.indices.size() / 3 << " tris, ACMR "
+                << std::fixed << std::setprecision(3) << acmr_before << " -> " << acmr_after << std::defaultfloat << std::endl;
+
+            unique_count += mesh.vertices.size();
             model.meshes.push_back(mesh);
         }
 
+        std::cout << "Welded " << corner_count << " corners -> " << unique_count << " unique vertices" << std::endl;
+
+        // --- 🟢 步骤 4：包围体 + 自动缩放矩阵 ---
+        Vector3f lo = Vector3f::Constant(std::numeric_limits<float>::max());
+        Vector3f hi = Vector3f::Constant(std::numeric_limits<float>::lowest());
+        for (const auto& mesh : model.meshes) {
+            for (const auto& v : mesh.vertices) {
+                lo = lo.cwiseMin(v);
+                hi = hi.cwiseMax(v);
+            }
+        }
+        if (unique_count == 0) lo = hi = Vector3f::Zero();
+        model.aabb_min = lo;
+        model.aabb_max = hi;
+
+        Vector3f center = (lo + hi) / 2.0f;
+        float radius2 = 0.0f;
+        for (const auto& mesh : model.meshes) {
+            for (const auto& v : mesh.vertices) radius2 = std::max(radius2, (v - center).squaredNorm());
+        }
+        model.sphere_center = center;
+        model.sphere_radius = std::sqrt(radius2);
+
+        float max_dim = (hi - lo).maxCoeff();
+        float scale = max_dim > 0.0f ? FIT_SIZE / max_dim : 1.0f;
+        model.normalization = Matrix4f::Identity();
+        model.normalization.topLeftCorner<3, 3>() *= scale;
+        model.normalization.topRightCorner<3, 1>() = -center * scale;
         return true;
     }
 }
\ No newline at end of file
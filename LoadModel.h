@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <cstdint>
 #include <string>
 #include <Eigen/Dense>
 
@@ -8,20 +9,46 @@ using namespace Eigen;
 namespace LoadModel {
 
     // һͷ
+    // vertices / texcoords / normals ǺӺظĶ (һһӦ)
+    // indices ÿ 3 һһΣȾʱÿÿֻ֡任һ
     struct SubMesh {
         std::vector<Vector3f> vertices;
         std::vector<Vector2f> texcoords;
         std::vector<Vector3f> normals;
+        std::vector<uint32_t> indices;
         int texture_id; // Ӧڼͼ
         bool is_face;
+        bool double_sided; // ˫ (ͷȹౡƬ)޳
     };
 
+    // Զźģߵĳ
+    static const float FIT_SIZE = 10.0f;
+
     // ģ
     struct Model {
         std::vector<SubMesh> meshes;       // ģɺܶಿ
         std::vector<std::string> texture_paths; // ͼļ
+
+        // Χ (ԭʼ)ʱɨһ鶥ã֮޳ڷŶɨ
+        Vector3f aabb_min = Vector3f::Zero(), aabb_max = Vector3f::Zero();
+        Vector3f sphere_center = Vector3f::Zero(); // ΧȡΧģ뾶ԶĶ (СΧ޳)
+        float sphere_radius = 0.0f;
+
+        // Զţвŵ FIT_SIZE (v - center) * scale дɾ
+        // ģ;ұߣ׶β𶥵
+        Matrix4f normalization = Matrix4f::Identity();
     };
 
+    // ģ post-transform 㻺С (FIFO)ź ACMR ͳƶ
+    static const int VERTEX_CACHE_SIZE = 16;
+
+    // ACMR (ƽÿεĻδд)1/2 ҽӽĹ3 ȫûи
+    float compute_acmr(const SubMesh& mesh, int cache_size = VERTEX_CACHE_SIZE);
+
+    // ʱһŻTipsify ߶㻺Уٰһαõ˳Ŷ (ȡʱ)
+    // ε򲻱
+    void optimize_vertex_cache(SubMesh& mesh, int cache_size = VERTEX_CACHE_SIZE);
+
     std::string clean_path(std::string path);
     bool load_obj(const std::string& path, const std::string& base_dir, Model& model);
 }
\ No newline at end of file
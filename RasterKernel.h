@@ -0,0 +1,623 @@
+﻿#pragma once
+// 主画面光栅化内核 (模板)。
+// V = float 时是标量版本 (Renderer.cpp)，V = Simd::F8 时是 AVX2 8 像素版本 (Renderer_avx2.cpp)。
+// 每次处理一行里连续的 W 个像素：覆盖测试、深度测试都用掩码，插值和光照全在向量寄存器里做，
+// 只有贴图采样和写颜色是逐通道的。
+// S 是着色器变体 (ShaderVariant)：材质组合在编译期确定，每种组合实例化一份没有材质分支的内核。
+// Msaa = true 时覆盖和深度逐采样点测试，着色仍然每像素一次 (在像素中心插值)。
+#include "Renderer.h"
+#include "Simd.h"
+
+// 这些辅助函数放在匿名命名空间里：两个编译单元用的指令集不同，不能让链接器把它们合并成一份
+namespace {
+
+// 脸部材质：BODY / FACE 是整个三角形统一的；PER_PIXEL 给延迟光照用 (同一组像素可能来自不同材质)
+enum class FaceKind { BODY, FACE, PER_PIXEL };
+
+// 着色器变体 (编译期常量)
+//   Textured : 有贴图 (false = 地板棋盘格)
+//   Face     : 脸不做二值化光照和边缘光
+//   Opaque   : 写深度、直接覆盖颜色；false = 半透明混合 (玻璃)
+template <bool Textured, FaceKind Face, bool Opaque>
+struct ShaderVariant {
+    static constexpr bool textured = Textured;
+    static constexpr FaceKind face = Face;
+    static constexpr bool opaque = Opaque;
+};
+
+// 延迟光照 pass 用的变体：贴图已经采样进 G-buffer，脸按像素区分，G-buffer 里只有不透明物体
+using DeferredLighting = ShaderVariant<true, FaceKind::PER_PIXEL, true>;
+
+// 按三角形的材质选出对应的变体，调用 f(S())。每次 draw 只判断一次
+template <class F>
+inline void with_shader_variant(bool textured, bool is_face, bool opaque, F&& f) {
+    switch ((textured ? 4 : 0) | (is_face ? 2 : 0) | (opaque ? 1 : 0)) {
+    case 0: f(ShaderVariant<false, FaceKind::BODY, false>()); break;
+    case 1: f(ShaderVariant<false, FaceKind::BODY, true>()); break;  // 地板
+    case 2: f(ShaderVariant<false, FaceKind::FACE, false>()); break;
+    case 3: f(ShaderVariant<false, FaceKind::FACE, true>()); break;
+    case 4: f(ShaderVariant<true, FaceKind::BODY, false>()); break;  // 玻璃
+    case 5: f(ShaderVariant<true, FaceKind::BODY, true>()); break;   // 身体/衣服
+    case 6: f(ShaderVariant<true, FaceKind::FACE, false>()); break;
+    default: f(ShaderVariant<true, FaceKind::FACE, true>()); break;  // 脸
+    }
+}
+
+// 一行的插值起点 (dy * y + c)
+struct VaryingRow {
+    float var[VARYING_COUNT]; // varying / w
+    float inv_w;              // 1 / w
+};
+
+// 着色用的逐三角形常量 (提前广播好)
+// 透视校正：varying / w 和 1 / w 在屏幕空间是线性的，按平面方程 f = dx * x + dy * y + c 计算。
+// 每行先算好 dy * y + c (VaryingRow)，行内每个像素是每个插值量一次乘加，外加一次求倒数得到 w
+template <class V>
+struct ShadeSetup {
+    V dx[VARYING_COUNT], inv_w_dx;
+    const RasterTriangle& tri;
+
+    float alpha;
+    const unsigned char* tex_data;
+    size_t tex_step;
+    V tex_w, tex_h;
+
+    ShadeSetup(const RasterTriangle& t, const cv::Mat& texture)
+        : inv_w_dx(t.inv_w_dx), tri(t),
+          alpha(t.alpha),
+          tex_data(texture.data), tex_step(texture.step),
+          tex_w((float)(texture.cols - 1)), tex_h((float)(texture.rows - 1)) {
+        for (int k = 0; k < VARYING_COUNT; k++) dx[k] = t.var_dx[k];
+    }
+
+    // 像素中心 y = py 这一行的起点
+    void row(float py, VaryingRow& out) const {
+        for (int k = 0; k < VARYING_COUNT; k++) out.var[k] = tri.var_dy[k] * py + tri.var_c[k];
+        out.inv_w = tri.inv_w_dy * py + tri.inv_w_c;
+    }
+    // 行内像素中心 x = px 处的所有插值量
+    void interpolate(const VaryingRow& row, V px, V* out) const {
+        V w = V(1.0f) / (V(row.inv_w) + px * inv_w_dx);
+        for (int k = 0; k < VARYING_COUNT; k++) out[k] = (V(row.var[k]) + px * dx[k]) * w;
+    }
+};
+
+// 光照用的常量 (和三角形无关，前向着色和延迟光照共用)
+template <class V>
+struct LightSetup {
+    using I = typename Simd::Lanes<V>::I;
+
+    V light_x, light_y, light_z;
+    V lit_threshold, rim_threshold;
+    const float* shadow_data;
+    const uint16_t* shadow_unorm; // 非空时阴影图是 UNORM16 格式 (shadow_data 不用)，按 near + q * step 还原深度
+    V shadow_near, shadow_step;
+    I shadow_w;
+    V shadow_wf, shadow_hf;
+
+    LightSetup(const ToonParams& toon, const float* shadow, const uint16_t* shadow16, float z_near, float z_far,
+               int shadow_width, int shadow_height)
+        : light_x(toon.light_dir.x()), light_y(toon.light_dir.y()), light_z(toon.light_dir.z()),
+          lit_threshold(toon.lit_threshold), rim_threshold(toon.rim_threshold),
+          shadow_data(shadow), shadow_unorm(shadow16),
+          shadow_near(z_near), shadow_step((z_far - z_near) / 65535.0f), shadow_w(shadow_width),
+          shadow_wf((float)(shadow_width - 1)), shadow_hf((float)(shadow_height - 1)) {}
+};
+
+// === A. 准备纹理颜色 ===
+template <class V, class S>
+inline void sample_albedo(const ShadeSetup<V>& sh, const V* var, int pass_bits, V& tex_r, V& tex_g, V& tex_b) {
+    using namespace Simd;
+    using M = typename Lanes<V>::M;
+    using I = typename Lanes<V>::I;
+    const int W = Lanes<V>::width;
+    const V zero = 0.0f, one = 1.0f;
+
+    alignas(32) float lane_r[8], lane_g[8], lane_b[8];
+    alignas(32) int lane_i[8], lane_j[8];
+
+    V u = vmin(one, vmax(zero, var[VAR_U]));
+    V v = vmin(one, vmax(zero, var[VAR_V]));
+
+    if constexpr (!S::textured) {
+        // 棋盘格逻辑 (地板)，u/v 已经夹到 [0,1]，取奇偶用 & 1 就行
+        I parity = to_int(vfloor(u * 10.0f) + vfloor(v * 10.0f)) & I(1);
+        M even = is_zero(parity);
+        tex_r = select(even, V(240.0f), V(180.0f));
+        tex_g = tex_r;
+        tex_b = select(even, V(240.0f), V(190.0f));
+    }
+    else {
+        // 正常读图逻辑：地址用向量算，取 texel 逐通道 (BGR 3 字节没法 gather)
+        to_lanes(to_int(u * sh.tex_w), lane_i);
+        to_lanes(to_int((one - v) * sh.tex_h), lane_j);
+        for (int i = 0; i < W; i++) {
+            if (!(pass_bits & (1 << i))) { lane_r[i] = lane_g[i] = lane_b[i] = 0.0f; continue; }
+            const unsigned char* texel = sh.tex_data + lane_j[i] * sh.tex_step + lane_i[i] * 3;
+            lane_b[i] = texel[0]; lane_g[i] = texel[1]; lane_r[i] = texel[2];
+        }
+        tex_r = from_lanes<V>(lane_r);
+        tex_g = from_lanes<V>(lane_g);
+        tex_b = from_lanes<V>(lane_b);
+    }
+}
+
+// 插值出光照需要的几何量：单位法线 + 阴影图坐标 (已经做完透视除法，映射到 [0,1])
+template <class V>
+inline void interpolate_surface(const V* var, V& nx, V& ny, V& nz, V& su, V& sv, V& sz) {
+    using namespace Simd;
+    const V zero = 0.0f, one = 1.0f, half = 0.5f;
+
+    V s_w = var[VAR_SW];
+    su = var[VAR_SX] / s_w * half + half;
+    sv = half - var[VAR_SY] / s_w * half; // 阴影图和主画面一样是 y 轴向下的
+    sz = var[VAR_SZ] / s_w * half + half;
+
+    nx = var[VAR_NX];
+    ny = var[VAR_NY];
+    nz = var[VAR_NZ];
+    V len2 = nx * nx + ny * ny + nz * nz;
+    V len = select(len2 > zero, vsqrt(len2), one); // 零向量保持不变 (和 Eigen normalized 一样)
+    nx = nx / len; ny = ny / len; nz = nz / len;
+}
+
+// 阴影 + 卡通光照 + 边缘光 -> 最终颜色
+// face 只在 S::face == PER_PIXEL 时有用，其余变体在编译期就知道是不是脸
+template <class V, class S>
+inline void light_lanes(const LightSetup<V>& ls, typename Simd::Lanes<V>::M pass, typename Simd::Lanes<V>::M face,
+                        V tex_r, V tex_g, V tex_b, V nx, V ny, V nz, V su, V sv, V sz,
+                        V& final_r, V& final_g, V& final_b) {
+    using namespace Simd;
+    using M = typename Lanes<V>::M;
+    using I = typename Lanes<V>::I;
+    const V zero = 0.0f, one = 1.0f;
+
+    // === B. 阴影查表 ===
+    // 地板阴影淡一点(0.7)，身体阴影(0.5)；两者都 < 0.9，落在阴影里就按冷色调压暗
+    M in_map = pass & (su >= zero) & (su < one) & (sv >= zero) & (sv < one);
+    M in_shadow = in_map;
+    if (any(in_map)) {
+        I sidx = to_int(sv * ls.shadow_hf) * ls.shadow_w + to_int(su * ls.shadow_wf);
+        V depth = ls.shadow_unorm ? ls.shadow_near + gather(ls.shadow_unorm, sidx, in_map) * ls.shadow_step
+                                  : gather(ls.shadow_data, sidx, in_map);
+        // Shadow Bias (0.005) 防止自阴影
+        in_shadow &= (sz - 0.005f > depth);
+    }
+
+    // === C. 卡通光照 (Toon Shading) ===
+    V NdotL = vmax(zero, nx * ls.light_x + ny * ls.light_y + nz * ls.light_z);
+
+    V light_r = one, light_b = one;
+    M body = pass;
+    if constexpr (S::face == FaceKind::PER_PIXEL) body = pass & !face;
+    if constexpr (S::face != FaceKind::FACE) {
+        // 身体/衣服：二值化光照，暗部用蓝紫色环境光 (脸不受影响)
+        M dark = body & !(NdotL > ls.lit_threshold);
+        light_r = select(dark, V(0.6f), one);
+        light_b = select(dark, V(0.75f), one);
+    }
+    // 叠加阴影 (冷色调)
+    light_r = select(in_shadow, light_r * 0.6f, light_r);
+    light_b = select(in_shadow, light_b * 0.75f, light_b);
+    V light_g = light_r;
+
+    // === D. 边缘光 (Rim Light) ===
+    V rim_r = zero, rim_b = zero;
+    if constexpr (S::opaque && S::face != FaceKind::FACE) {
+        V rim = one - vmax(zero, nz); // view_dir = (0, 0, 1)
+        rim = rim * rim;
+        rim = rim * rim;               // pow(x, 4)
+        M rim_on = body & (rim > ls.rim_threshold); // 硬边缘，淡淡的蓝光
+        rim_r = select(rim_on, V(50.0f), zero);
+        rim_b = select(rim_on, V(80.0f), zero);
+    }
+
+    // === E. 组合最终颜色 ===
+    final_r = tex_r * light_r + rim_r;
+    final_g = tex_g * light_g + rim_r;
+    final_b = tex_b * light_b + rim_b;
+}
+
+// 前向着色：给定插值好的 varyings 算出 W 个像素的颜色
+template <class V, class S>
+inline void shade_lanes(const ShadeSetup<V>& sh, const LightSetup<V>& ls, const V* var, typename Simd::Lanes<V>::M pass,
+                        V& final_r, V& final_g, V& final_b) {
+    using namespace Simd;
+    V tex_r, tex_g, tex_b, nx, ny, nz, su, sv, sz;
+    sample_albedo<V, S>(sh, var, bits(pass), tex_r, tex_g, tex_b);
+    interpolate_surface(var, nx, ny, nz, su, sv, sz);
+    light_lanes<V, S>(ls, pass, pass, tex_r, tex_g, tex_b, nx, ny, nz, su, sv, sz, final_r, final_g, final_b);
+}
+
+// === F. 写入像素 ===
+// 颜色缓冲是打包好的 32 位 BGRA (内存里依次是 B, G, R, A)，整组像素直接用掩码读写
+
+// 拆出 0~255 的三个通道
+template <class V>
+inline void unpack_color(typename Simd::Lanes<V>::I packed, V& r, V& g, V& b) {
+    using namespace Simd;
+    using I = typename Lanes<V>::I;
+    b = to_float(packed & I(255));
+    g = to_float(shr(packed, 8) & I(255));
+    r = to_float(shr(packed, 16) & I(255));
+}
+
+// 不透明直接覆盖；半透明 (Glass) 和背景按 alpha 混合
+template <class V, bool Opaque>
+inline void write_color(uint32_t* dst, typename Simd::Lanes<V>::M pass, float alpha, V final_r, V final_g, V final_b) {
+    using namespace Simd;
+    using I = typename Lanes<V>::I;
+
+    if constexpr (!Opaque) {
+        V dst_r, dst_g, dst_b;
+        unpack_color<V>(load((const int*)dst, pass), dst_r, dst_g, dst_b);
+        V keep = 1.0f - alpha;
+        final_r = final_r * alpha + dst_r * keep;
+        final_g = final_g * alpha + dst_g * keep;
+        final_b = final_b * alpha + dst_b * keep;
+    }
+
+    I r = to_int(vmin(V(255.0f), final_r));
+    I g = to_int(vmin(V(255.0f), final_g));
+    I b = to_int(vmin(V(255.0f), final_b));
+    store((int*)dst, pass, b | (g << 8) | (r << 16) | I((int)0xFF000000u));
+}
+
+// 加权混合 OIT：半透明片元只往累积平面里加，不碰颜色缓冲，合成在 resolve_oit_tile 里做。
+// 权重按观察空间深度 view_z 衰减 (McGuire & Bavoil 的深度权重)，限制在 [0.01, 3000] 避免溢出和全为 0。
+// alpha 逐通道：MSAA 时乘上采样点覆盖率，共享边上两个三角形各盖一半的像素不会被叠两次
+template <class V>
+inline void accumulate_oit(float* r, float* g, float* b, float* a, float* reveal, typename Simd::Lanes<V>::M pass,
+                           V alpha, V view_z, V final_r, V final_g, V final_b) {
+    using namespace Simd;
+    V d_near = view_z * 0.2f, d_far = view_z * 0.005f;
+    d_near = d_near * d_near;
+    d_far = d_far * d_far * d_far;
+    d_far = d_far * d_far;
+    V weight = alpha * vmin(V(3e3f), vmax(V(1e-2f), V(10.0f) / (V(1e-5f) + d_near + d_far)));
+    V cr = vmin(V(255.0f), final_r), cg = vmin(V(255.0f), final_g), cb = vmin(V(255.0f), final_b);
+    store(r, pass, load(r, pass) + cr * weight);
+    store(g, pass, load(g, pass) + cg * weight);
+    store(b, pass, load(b, pass) + cb * weight);
+    store(a, pass, load(a, pass) + weight);
+    store(reveal, pass, load(reveal, pass) * (V(1.0f) - alpha));
+}
+
+}
+
+template <class V, class S, bool Msaa>
+void Renderer::draw_triangle_lanes(const RasterTriangle& t, int x0, int y0, int x1, int y1, ShadingMode pass_mode, int vis_id) {
+    using namespace Simd;
+    using M = typename Lanes<V>::M;
+    using I = typename Lanes<V>::I;
+    const int W = Lanes<V>::width;
+
+    const TriangleSetup& tri = t.setup;
+
+    int min_x = tri.min_x > x0 ? tri.min_x : x0;
+    int max_x = tri.max_x < x1 ? tri.max_x : x1;
+    int min_y = tri.min_y > y0 ? tri.min_y : y0;
+    int max_y = tri.max_y < y1 ? tri.max_y : y1;
+
+    // 0. Hi-Z：深度是屏幕空间的线性函数 z(x, y) = z_dx * x + z_dy * y + z_c，块内最小 / 最大值一定在角上
+    // 比较时留一点余量，抵消舍入差，保证只剔除真正看不见的部分、只直接接受真正在最前面的部分；
+    // MSAA 时角要外扩到最外面的采样点
+    const float hiz_eps = 1e-5f;
+    const float hiz_pad = Msaa ? (float)MSAA_SAMPLE_RADIUS / TriangleSetup::SUBPIXEL_SCALE : 0.0f;
+    const float z_dx = t.z_dx, z_dy = t.z_dy, z_c = t.z_c;
+    const size_t tile_index = (y0 / TILE_SIZE) * tiles_x + x0 / TILE_SIZE;
+    bool tile_accept = false; // 整个三角形都比 tile 里已有的深度近：所有片元都必然通过深度测试
+    if (hiz_enabled) {
+        if (t.z_min - hiz_eps >= hiz_tile[tile_index]) return;
+        tile_accept = t.z_max + hiz_eps < hiz_tile_min[tile_index];
+    }
+    bool hiz_dirty = false;
+
+    // 整个三角形不变的量先广播好
+    const V zero = 0.0f, one = 1.0f;
+    const V z_step = z_dx;
+    const ShadeSetup<V> sh(t, frame_textures[t.texture_slot]);
+    const LightSetup<V> ls(toon, shadow_buffer.data(), shadow_unorm_data(), shadow_z_near, shadow_z_far, shadow_width, shadow_height);
+    const V material = S::face == FaceKind::FACE ? 2.0f : 1.0f;
+    const bool oit_pass = !S::opaque && transparency == TransparencyMode::WEIGHTED_OIT;
+
+    // MSAA：采样点相对像素中心的偏移是常数，深度和重心坐标在采样点上的值只差一个常数
+    float z_off[MSAA_SAMPLES], a_off[MSAA_SAMPLES], b_off[MSAA_SAMPLES];
+    if constexpr (Msaa) {
+        for (int s = 0; s < MSAA_SAMPLES; s++) {
+            const float ox = (float)MSAA_SAMPLE_OFFSET[s][0] / TriangleSetup::SUBPIXEL_SCALE;
+            const float oy = (float)MSAA_SAMPLE_OFFSET[s][1] / TriangleSetup::SUBPIXEL_SCALE;
+            z_off[s] = z_dx * ox + z_dy * oy;
+            a_off[s] = tri.a_dx * ox + tri.a_dy * oy;
+            b_off[s] = tri.b_dx * ox + tri.b_dy * oy;
+        }
+    }
+
+    // 1. 按 8x8 的块遍历包围盒：整块在外面的跳过，整块在里面的省掉逐像素覆盖测试
+    const int B = BLOCK_SIZE;
+    for (int by = min_y - min_y % B; by <= max_y; by += B) {
+        for (int bx = min_x - min_x % B; bx <= max_x; bx += B) {
+            const int bx0 = bx > min_x ? bx : min_x, bx1 = bx + B - 1 < max_x ? bx + B - 1 : max_x;
+            const int by0 = by > min_y ? by : min_y, by1 = by + B - 1 < max_y ? by + B - 1 : max_y;
+
+            unsigned inside_edges = 0;
+            const TriangleSetup::Coverage block = tri.classify_block(bx0, by0, bx1, by1, &inside_edges);
+            if (block == TriangleSetup::OUTSIDE) continue;
+            const bool full = block == TriangleSetup::INSIDE;
+
+            // accept：块里的片元不用读 z_buffer 就知道能通过深度测试
+            bool accept = tile_accept;
+            if (hiz_enabled) {
+                const int block_index = (by / B) * blocks_x + bx / B;
+                float zx = z_dx > 0 ? bx0 + 0.5f - hiz_pad : bx1 + 0.5f + hiz_pad;
+                float zy = z_dy > 0 ? by0 + 0.5f - hiz_pad : by1 + 0.5f + hiz_pad;
+                float block_z_min = z_c + z_dx * zx + z_dy * zy;
+                if (block_z_min - hiz_eps >= hiz_block[block_index]) continue;
+                if (!accept) {
+                    zx = z_dx > 0 ? bx1 + 0.5f + hiz_pad : bx0 + 0.5f - hiz_pad;
+                    zy = z_dy > 0 ? by1 + 0.5f + hiz_pad : by0 + 0.5f - hiz_pad;
+                    float block_z_max = z_c + z_dx * zx + z_dy * zy;
+                    accept = block_z_max + hiz_eps < hiz_block_min[block_index];
+                }
+            }
+            bool block_written = false;
+
+            // 定点数模式下，部分覆盖块里跨过块的边在块内的取值范围很小，可以用 32 位整数逐像素步进；
+            // 整块都在内侧的边直接置 0 (恒通过)，不参与计算
+            int e_row[3], e_dx[3], e_dy[3];
+            int e_off[MSAA_SAMPLES][3]; // MSAA：各采样点相对像素中心的边函数增量
+            if (tri.fixed && !full) {
+                for (int e = 0; e < 3; e++) {
+                    bool skip = (inside_edges >> e) & 1;
+                    e_row[e] = skip ? 0 : (int)(tri.e_a[e] * bx0 + tri.e_b[e] * by0 + tri.e_c[e]);
+                    e_dx[e] = skip ? 0 : (int)tri.e_a[e];
+                    e_dy[e] = skip ? 0 : (int)tri.e_b[e];
+                    if constexpr (Msaa) {
+                        for (int s = 0; s < MSAA_SAMPLES; s++) {
+                            e_off[s][e] = (e_dx[e] * MSAA_SAMPLE_OFFSET[s][0] + e_dy[e] * MSAA_SAMPLE_OFFSET[s][1]) / TriangleSetup::SUBPIXEL_SCALE;
+                        }
+                    }
+                }
+            }
+
+            for (int y = by0; y <= by1; y++) {
+                // 2. 平面方程：每行算一次起点 (dy * y + c)，行内每个像素只剩一次乘加
+                float py = (float)y + 0.5f;
+                const float z_row_base = z_dy * py + z_c;
+                VaryingRow var_row{};
+                if (pass_mode != ShadingMode::VISIBILITY) sh.row(py, var_row);
+
+                I e0 = I(0), e1 = I(0), e2 = I(0);
+                if (tri.fixed && !full) {
+                    e0 = I(e_row[0]) + Lanes<V>::ramp_i() * I(e_dx[0]);
+                    e1 = I(e_row[1]) + Lanes<V>::ramp_i() * I(e_dx[1]);
+                    e2 = I(e_row[2]) + Lanes<V>::ramp_i() * I(e_dx[2]);
+                    for (int e = 0; e < 3; e++) e_row[e] += e_dy[e];
+                }
+
+                // 行起始地址对应 x = x0 (tile 左边界)，两种缓冲布局下一行里的像素都是连续的
+                float* z_row = depth_row(y, x0, y0);
+                uint32_t* c_row = color_row(y, x0, y0);
+                const size_t row = pixel_index(y, x0, y0);
+
+                for (int x = bx0; x <= bx1; x += W) {
+                    const V px = V((float)x + 0.5f) + Lanes<V>::ramp();
+                    const size_t i = row + (x - x0);
+                    V z_current = V(z_row_base) + px * z_step;
+                    M pass;
+                    M sample_pass[MSAA_SAMPLES];
+                    V sample_z[MSAA_SAMPLES];
+
+                    if constexpr (Msaa) {
+                        // 3. + 4. 逐采样点的覆盖测试和深度测试，任何一个采样点通过这个像素就要着色
+                        I e[3] = { I(0), I(0), I(0) };
+                        if (tri.fixed && !full) {
+                            e[0] = e0; e[1] = e1; e[2] = e2;
+                            e0 += I(e_dx[0] * W); e1 += I(e_dx[1] * W); e2 += I(e_dx[2] * W);
+                        }
+                        pass = Lanes<V>::first(0);
+                        for (int s = 0; s < MSAA_SAMPLES; s++) {
+                            M covered = Lanes<V>::first(bx1 - x + 1);
+                            if (!full) {
+                                if (tri.fixed) {
+                                    covered &= is_nonneg(e[0] + I(e_off[s][0])) & is_nonneg(e[1] + I(e_off[s][1])) & is_nonneg(e[2] + I(e_off[s][2]));
+                                }
+                                else {
+                                    V a = px * tri.a_dx + V(tri.a_dy * py + tri.a_c + a_off[s]);
+                                    V b = px * tri.b_dx + V(tri.b_dy * py + tri.b_c + b_off[s]);
+                                    covered &= (a >= zero) & (b >= zero) & (one - a - b >= zero);
+                                }
+                            }
+                            sample_z[s] = z_current + V(z_off[s]);
+                            const float* z_sample = s == 0 ? z_row + (x - x0) : sample_depth(s, i);
+                            sample_pass[s] = accept ? covered : covered & (sample_z[s] < load(z_sample, covered));
+                            pass = pass | sample_pass[s];
+                        }
+                        if (!any(pass)) continue;
+                    }
+                    else {
+                        // 整块在内时不用测；两种模式都与绕序无关，天然支持双面渲染
+                        M inside = Lanes<V>::first(bx1 - x + 1);
+                        if (!full) {
+                            if (tri.fixed) {
+                                inside &= is_nonneg(e0) & is_nonneg(e1) & is_nonneg(e2);
+                                e0 += I(e_dx[0] * W); e1 += I(e_dx[1] * W); e2 += I(e_dx[2] * W);
+                            }
+                            else {
+                                V a = px * tri.a_dx + V(tri.a_dy * py + tri.a_c);
+                                V b = px * tri.b_dx + V(tri.b_dy * py + tri.b_c);
+                                inside &= (a >= zero) & (b >= zero) & (one - a - b >= zero);
+                            }
+                            if (!any(inside)) continue;
+                        }
+
+                        // 3. 插值 Z + 4. 深度测试 (掩码比较)
+                        pass = accept ? inside : inside & (z_current < load(z_row + (x - x0), inside));
+                        if (!any(pass)) continue;
+                    }
+
+                    // 可见性缓冲第一遍：只写深度和三角形编号，着色留到 resolve_visibility
+                    if (!Msaa && pass_mode == ShadingMode::VISIBILITY) {
+                        store(z_row + (x - x0), pass, z_current);
+                        store(&vis_buffer[row + (x - x0)], pass, I(vis_id));
+                        block_written = true;
+                        continue;
+                    }
+
+                    // 延迟着色第一遍：写 G-buffer (反照率、法线、阴影图坐标、材质)，光照留到 light_gbuffer
+                    if (!Msaa && pass_mode == ShadingMode::DEFERRED) {
+                        V var[VARYING_COUNT], tex_r, tex_g, tex_b, nx, ny, nz, su, sv, sz;
+                        sh.interpolate(var_row, px, var);
+                        sample_albedo<V, S>(sh, var, bits(pass), tex_r, tex_g, tex_b);
+                        interpolate_surface(var, nx, ny, nz, su, sv, sz);
+                        store(z_row + (x - x0), pass, z_current);
+                        store(&gbuffer.nx[i], pass, nx); store(&gbuffer.ny[i], pass, ny); store(&gbuffer.nz[i], pass, nz);
+                        store(&gbuffer.su[i], pass, su); store(&gbuffer.sv[i], pass, sv); store(&gbuffer.sz[i], pass, sz);
+                        store(&gbuffer.material[i], pass, material);
+                        write_color<V, true>(&gbuffer.albedo[i], pass, 1.0f, tex_r, tex_g, tex_b);
+                        block_written = true;
+                        continue;
+                    }
+
+                    V var[VARYING_COUNT], final_r, final_g, final_b;
+                    sh.interpolate(var_row, px, var);
+                    shade_lanes<V, S>(sh, ls, var, pass, final_r, final_g, final_b);
+
+                    // 半透明 + OIT：不写深度也不写颜色，只累积 (MSAA 时按像素累积，任何一个采样点通过就算)
+                    if constexpr (!S::opaque) {
+                        if (oit_pass) {
+                            V alpha = t.alpha;
+                            if constexpr (Msaa) {
+                                V coverage = zero;
+                                for (int s = 0; s < MSAA_SAMPLES; s++) coverage += select(sample_pass[s], V(1.0f / MSAA_SAMPLES), zero);
+                                alpha *= coverage;
+                            }
+                            V view_z = V(1.0f) / (V(var_row.inv_w) + px * sh.inv_w_dx);
+                            accumulate_oit<V>(&oit.r[i], &oit.g[i], &oit.b[i], &oit.a[i], &oit.reveal[i], pass,
+                                              alpha, view_z, final_r, final_g, final_b);
+                            continue;
+                        }
+                    }
+
+                    // 不透明 (Body/Face) -> 写 Z，覆盖颜色；半透明 (Glass) -> 不写 Z，和背景混合
+                    if constexpr (Msaa) {
+                        // 深度逐采样点写；颜色只要 tile 还是压缩的、每个像素的采样点又全部通过，就只写 0 号采样点
+                        M whole = pass;
+                        for (int s = 0; s < MSAA_SAMPLES; s++) {
+                            if constexpr (S::opaque) store(s == 0 ? z_row + (x - x0) : sample_depth(s, i), sample_pass[s], sample_z[s]);
+                            whole &= sample_pass[s];
+                        }
+                        if constexpr (S::opaque) block_written = true;
+                        if (!msaa_expanded[tile_index] && bits(whole) != bits(pass)) expand_msaa_tile(x0, y0, x1, y1);
+
+                        if (!msaa_expanded[tile_index]) {
+                            write_color<V, S::opaque>(c_row + (x - x0), pass, t.alpha, final_r, final_g, final_b);
+                        }
+                        else {
+                            for (int s = 0; s < MSAA_SAMPLES; s++) {
+                                uint32_t* dst = s == 0 ? c_row + (x - x0) : sample_color(s, i);
+                                write_color<V, S::opaque>(dst, sample_pass[s], t.alpha, final_r, final_g, final_b);
+                            }
+                        }
+                        continue;
+                    }
+                    if constexpr (S::opaque) {
+                        store(z_row + (x - x0), pass, z_current);
+                        block_written = true;
+                    }
+                    write_color<V, S::opaque>(c_row + (x - x0), pass, t.alpha, final_r, final_g, final_b);
+                }
+            }
+
+            // 这块写过深度，重新统计块内深度范围 (块要完整，不能只看三角形包围盒里的部分)
+            // 关掉 Hi-Z 时也要维护：get_block_depth_range 一直可用
+            if (block_written) {
+                update_hiz_block(bx, by, x0, y0, x1, y1);
+                hiz_dirty = true;
+            }
+        }
+    }
+    if (hiz_dirty) update_hiz_tile(x0, y0, x1, y1);
+}
+
+// 可见性缓冲第二遍：每个可见像素只着色一次。
+// 同一行里编号相同的连续像素作为一段，按 W 个一组用平面方程重新插值再着色。
+template <class V>
+void Renderer::resolve_visibility_lanes(int x0, int y0, int x1, int y1) {
+    using namespace Simd;
+    const int W = Lanes<V>::width;
+    const LightSetup<V> ls(toon, shadow_buffer.data(), shadow_unorm_data(), shadow_z_near, shadow_z_far, shadow_width, shadow_height);
+
+    for (int y = y0; y <= y1; y++) {
+        const int* ids = &vis_buffer[pixel_index(y, x0, y0)];
+        uint32_t* c_row = color_row(y, x0, y0);
+        const float py = (float)y + 0.5f;
+
+        for (int x = x0; x <= x1;) {
+            const int id = ids[x - x0];
+            int end = x + 1;
+            while (end <= x1 && ids[end - x0] == id) end++;
+            if (id < 0) { x = end; continue; }
+
+            const RasterTriangle& t = tri_queue[id];
+            const ShadeSetup<V> sh(t, frame_textures[t.texture_slot]);
+            VaryingRow var_row;
+            sh.row(py, var_row);
+
+            // 编号缓冲里只有不透明三角形
+            with_shader_variant(!frame_textures[t.texture_slot].empty(), t.is_face, true, [&](auto variant) {
+                using S = decltype(variant);
+                for (int sx = x; sx < end; sx += W) {
+                    auto pass = Lanes<V>::first(end - sx);
+                    V var[VARYING_COUNT], final_r, final_g, final_b;
+                    sh.interpolate(var_row, V((float)sx + 0.5f) + Lanes<V>::ramp(), var);
+                    shade_lanes<V, S>(sh, ls, var, pass, final_r, final_g, final_b);
+                    write_color<V, true>(c_row + (sx - x0), pass, 1.0f, final_r, final_g, final_b);
+                }
+            });
+            x = end;
+        }
+    }
+}
+
+// 延迟着色第二遍：整个 tile 一起做光照，只读 G-buffer，不再碰三角形
+template <class V>
+void Renderer::light_gbuffer_lanes(int x0, int y0, int x1, int y1) {
+    using namespace Simd;
+    using M = typename Lanes<V>::M;
+    const int W = Lanes<V>::width;
+    const LightSetup<V> ls(toon, shadow_buffer.data(), shadow_unorm_data(), shadow_z_near, shadow_z_far, shadow_width, shadow_height);
+
+    for (int y = y0; y <= y1; y++) {
+        const size_t row = pixel_index(y, x0, y0);
+        uint32_t* c_row = color_row(y, x0, y0);
+
+        for (int x = x0; x <= x1; x += W) {
+            const size_t i = row + (x - x0);
+            M valid = Lanes<V>::first(x1 - x + 1);
+            V material = load(&gbuffer.material[i], valid);
+            M pass = valid & (material > V(0.5f)); // 0 = 本批次没有不透明物体覆盖
+            if (!any(pass)) continue;
+
+            V albedo_r, albedo_g, albedo_b;
+            unpack_color<V>(load((const int*)&gbuffer.albedo[i], pass), albedo_r, albedo_g, albedo_b);
+
+            V final_r, final_g, final_b;
+            light_lanes<V, DeferredLighting>(ls, pass, material > V(1.5f),
+                        albedo_r, albedo_g, albedo_b,
+                        load(&gbuffer.nx[i], pass), load(&gbuffer.ny[i], pass), load(&gbuffer.nz[i], pass),
+                        load(&gbuffer.su[i], pass), load(&gbuffer.sv[i], pass), load(&gbuffer.sz[i], pass),
+                        final_r, final_g, final_b);
+            write_color<V, true>(c_row + (x - x0), pass, 1.0f, final_r, final_g, final_b);
+        }
+    }
+}
+
+// 每次 draw 按材质选一次变体
+template <class V>
+void Renderer::draw_triangle_variant(const RasterTriangle& t, int x0, int y0, int x1, int y1, ShadingMode pass, int vis_id) {
+    with_shader_variant(!frame_textures[t.texture_slot].empty(), t.is_face, t.alpha > 0.9f, [&](auto variant) {
+        if (msaa_z.empty()) draw_triangle_lanes<V, decltype(variant), false>(t, x0, y0, x1, y1, pass, vis_id);
+        else draw_triangle_lanes<V, decltype(variant), true>(t, x0, y0, x1, y1, pass, vis_id);
+    });
+}
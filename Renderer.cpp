@@ -1,16 +1,40 @@
 ﻿#include "Renderer.h"
+#include "RasterKernel.h"
 #include "MathUtils.h" 
 #include <algorithm>   
 #include <cmath> 
 #include <limits> 
+#include <cstring>
 
 using namespace MathUtils;
 
+// 打包成 color_buffer 的格式：内存里依次是 B, G, R, A (小端序下就是 0xAARRGGBB)
+static inline uint32_t pack_color(int r, int g, int b) {
+    return 0xFF000000u | (uint32_t)r << 16 | (uint32_t)g << 8 | (uint32_t)b;
+}
+
 // --- 构造函数 ---
 Renderer::Renderer(int w, int h) : width(w), height(h) {
-    frame_buffer = Mat(height, width, CV_8UC3);
+    color_buffer.assign((size_t)width * height, pack_color(0, 0, 0));
+    frame_buffer = Mat(height, width, CV_8UC4, color_buffer.data()); // 不拷贝，共用同一块内存
     z_buffer.resize(width * height);
     std::fill(z_buffer.begin(), z_buffer.end(), std::numeric_limits<float>::infinity());
+
+    tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    tile_bins.resize(tiles_x * tiles_y);
+    sorted_bins.resize(tiles_x * tiles_y);
+
+    blocks_x = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    blocks_y = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    hiz_block.assign(blocks_x * blocks_y, std::numeric_limits<float>::infinity());
+    hiz_block_min.assign(blocks_x * blocks_y, std::numeric_limits<float>::infinity());
+    hiz_tile.assign(tiles_x * tiles_y, std::numeric_limits<float>::infinity());
+    hiz_tile_min.assign(tiles_x * tiles_y, std::numeric_limits<float>::infinity());
+    depth_tile_state.assign(tiles_x * tiles_y, TILE_CLEARED);
+
+    pool = std::make_unique<ThreadPool>();
+    set_simd_enabled(true);
 }
 
 Renderer::~Renderer() {
@@ -18,8 +42,10 @@ Renderer::~Renderer() {
 
 // 替换原来的 clear()
 void Renderer::clear(Skybox& skybox, const Vector3f& camera_pos, const Vector3f& camera_target) {
-    // 1. 清空 Z-Buffer
-    std::fill(z_buffer.begin(), z_buffer.end(), std::numeric_limits<float>::infinity());
+    // 1. 清空 Z-Buffer：只打标记，flush 时按 tile 再清 (见 clear_depth_tile)
+    for (auto& state : depth_tile_state) {
+        if (state == TILE_DIRTY) state = TILE_STALE;
+    }
 
     // 2. 如果没加载天空盒，就填个渐变色保底
     if (!skybox.is_loaded) {
@@ -30,7 +56,7 @@ void Renderer::clear(Skybox& skybox, const Vector3f& camera_pos, const Vector3f&
                 unsigned char b = (unsigned char)(235 * (1 - t) + 240 * t);
                 unsigned char g = (unsigned char)(206 * (1 - t) + 240 * t);
                 unsigned char r = (unsigned char)(135 * (1 - t) + 240 * t);
-                frame_buffer.at<Vec3b>(y, x) = Vec3b(b, g, r);
+                color_buffer[y * width + x] = pack_color(r, g, b);
             }
         }
         return;
@@ -66,7 +92,7 @@ void Renderer::clear(Skybox& skybox, const Vector3f& camera_pos, const Vector3f&
             Vector3i color = skybox.sample(dir);
 
             // 写入 Framebuffer
-            frame_buffer.at<Vec3b>(y, x) = Vec3b(color.z(), color.y(), color.x());
+            color_buffer[y * width + x] = pack_color(color.x(), color.y(), color.z());
         }
     }
 }
@@ -75,11 +101,193 @@ Mat& Renderer::get_frame_buffer() {
     return frame_buffer;
 }
 
+void Renderer::swap_color_buffer(std::vector<uint32_t>& buffer) {
+    color_buffer.swap(buffer);
+    color_buffer.resize((size_t)width * height);
+    frame_buffer = Mat(height, width, CV_8UC4, color_buffer.data());
+}
+
+void Renderer::set_buffer_layout(BufferLayout l) {
+    layout = l;
+    if (layout == BufferLayout::TILED) {
+        // 边缘不满的 tile 也按 64x64 分配，省得算地址时特判
+        size_t tile_pixels = (size_t)TILE_SIZE * TILE_SIZE;
+        z_buffer.assign(tile_pixels * tiles_x * tiles_y, std::numeric_limits<float>::infinity());
+        color_tiles.assign(tile_pixels * tiles_x * tiles_y, 0);
+        z_linear.assign(width * height, std::numeric_limits<float>::infinity());
+    }
+    else {
+        z_buffer.assign(width * height, std::numeric_limits<float>::infinity());
+        color_tiles.clear();
+        z_linear.clear();
+    }
+    std::fill(hiz_block.begin(), hiz_block.end(), std::numeric_limits<float>::infinity());
+    std::fill(hiz_block_min.begin(), hiz_block_min.end(), std::numeric_limits<float>::infinity());
+    std::fill(hiz_tile.begin(), hiz_tile.end(), std::numeric_limits<float>::infinity());
+    std::fill(hiz_tile_min.begin(), hiz_tile_min.end(), std::numeric_limits<float>::infinity());
+    std::fill(depth_tile_state.begin(), depth_tile_state.end(), TILE_CLEARED);
+    resize_shading_buffers();
+}
+
+// --- 缓冲寻址 ---
+float* Renderer::depth_row(int y, int tile_x0, int tile_y0) {
+    if (layout == BufferLayout::LINEAR) return &z_buffer[y * width + tile_x0];
+    size_t tile = (tile_y0 / TILE_SIZE) * tiles_x + tile_x0 / TILE_SIZE;
+    return &z_buffer[tile * TILE_SIZE * TILE_SIZE + (y - tile_y0) * TILE_SIZE];
+}
+
+// 编号缓冲、G-buffer 和深度缓冲一一对应，直接复用深度的寻址
+size_t Renderer::pixel_index(int y, int tile_x0, int tile_y0) {
+    return depth_row(y, tile_x0, tile_y0) - z_buffer.data();
+}
+
+uint32_t* Renderer::color_row(int y, int tile_x0, int tile_y0) {
+    if (layout == BufferLayout::LINEAR) return &color_buffer[(size_t)y * width + tile_x0];
+    size_t tile = (tile_y0 / TILE_SIZE) * tiles_x + tile_x0 / TILE_SIZE;
+    return &color_tiles[tile * TILE_SIZE * TILE_SIZE + (y - tile_y0) * TILE_SIZE];
+}
+
+// --- Hi-Z 维护 ---
+// (bx, by) 是块的左下角像素，块按 BLOCK_SIZE 对齐，不会跨 tile
+float Renderer::update_hiz_block(int bx, int by, int x0, int y0, int x1, int y1) {
+    int ex = std::min(bx + BLOCK_SIZE - 1, x1), ey = std::min(by + BLOCK_SIZE - 1, y1);
+    float z_min = std::numeric_limits<float>::infinity();
+    float z_max = -std::numeric_limits<float>::infinity();
+    for (int y = by; y <= ey; y++) {
+        const float* z = depth_row(y, x0, y0) + (bx - x0);
+        for (int i = 0; i <= ex - bx; i++) {
+            z_min = std::min(z_min, z[i]);
+            z_max = std::max(z_max, z[i]);
+        }
+        // MSAA：范围要包住块里所有的采样点
+        if (!msaa_z.empty()) {
+            const size_t row = pixel_index(y, x0, y0) + (bx - x0);
+            for (int s = 1; s < MSAA_SAMPLES; s++) {
+                z = sample_depth(s, row);
+                for (int i = 0; i <= ex - bx; i++) {
+                    z_min = std::min(z_min, z[i]);
+                    z_max = std::max(z_max, z[i]);
+                }
+            }
+        }
+    }
+    const int block = (by / BLOCK_SIZE) * blocks_x + bx / BLOCK_SIZE;
+    hiz_block_min[block] = z_min;
+    hiz_block[block] = z_max;
+    return z_max;
+}
+
+void Renderer::update_hiz_tile(int x0, int y0, int x1, int y1) {
+    float z_min = std::numeric_limits<float>::infinity();
+    float z_max = -std::numeric_limits<float>::infinity();
+    for (int by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++) {
+        for (int bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++) {
+            z_min = std::min(z_min, hiz_block_min[by * blocks_x + bx]);
+            z_max = std::max(z_max, hiz_block[by * blocks_x + bx]);
+        }
+    }
+    const int tile = (y0 / TILE_SIZE) * tiles_x + x0 / TILE_SIZE;
+    hiz_tile_min[tile] = z_min;
+    hiz_tile[tile] = z_max;
+}
+
+void Renderer::get_block_depth_range(int bx, int by, float& z_min, float& z_max) const {
+    z_min = hiz_block_min[by * blocks_x + bx];
+    z_max = hiz_block[by * blocks_x + bx];
+}
+
+// TILED：clear() 和画线都直接写在 color_buffer 上，光栅化前先把这块拷进 tile
+void Renderer::load_color_tile(int tile) {
+    int x0 = (tile % tiles_x) * TILE_SIZE, y0 = (tile / tiles_x) * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, width) - 1, y1 = std::min(y0 + TILE_SIZE, height) - 1;
+    for (int y = y0; y <= y1; y++) {
+        const uint32_t* src = &color_buffer[(size_t)y * width + x0];
+        std::copy(src, src + (x1 - x0 + 1), color_row(y, x0, y0));
+    }
+}
+
+// TILED：把 tile 解析回行优先的 color_buffer 和 z_linear
+void Renderer::resolve_tile(int tile) {
+    int x0 = (tile % tiles_x) * TILE_SIZE, y0 = (tile / tiles_x) * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, width) - 1, y1 = std::min(y0 + TILE_SIZE, height) - 1;
+    for (int y = y0; y <= y1; y++) {
+        const uint32_t* c = color_row(y, x0, y0);
+        std::copy(c, c + (x1 - x0 + 1), &color_buffer[(size_t)y * width + x0]);
+        const float* z = depth_row(y, x0, y0);
+        std::copy(z, z + (x1 - x0 + 1), &z_linear[y * width + x0]);
+    }
+}
+
+// MSAA：tile 里第一次出现部分覆盖的像素，把 0 号采样点的颜色复制到其余采样平面
+void Renderer::expand_msaa_tile(int x0, int y0, int x1, int y1) {
+    for (int y = y0; y <= y1; y++) {
+        const uint32_t* c = color_row(y, x0, y0);
+        const size_t row = pixel_index(y, x0, y0);
+        for (int s = 1; s < MSAA_SAMPLES; s++) {
+            std::copy(c, c + (x1 - x0 + 1), sample_color(s, row));
+        }
+    }
+    msaa_expanded[(y0 / TILE_SIZE) * tiles_x + x0 / TILE_SIZE] = 1;
+}
+
+// MSAA：把展开过的 tile 的采样点平均到 0 号采样点 (也就是最终颜色)，之后这个 tile 回到压缩状态。
+// 压缩的 tile 所有采样点颜色相同，什么都不用做。深度保持逐采样点，后续绘制照常做深度测试
+void Renderer::resolve_msaa_tile(int x0, int y0, int x1, int y1) {
+    unsigned char& expanded = msaa_expanded[(y0 / TILE_SIZE) * tiles_x + x0 / TILE_SIZE];
+    if (!expanded) return;
+    for (int y = y0; y <= y1; y++) {
+        uint32_t* c = color_row(y, x0, y0);
+        const size_t row = pixel_index(y, x0, y0);
+        const uint32_t* s1 = sample_color(1, row);
+        const uint32_t* s2 = sample_color(2, row);
+        const uint32_t* s3 = sample_color(3, row);
+        for (int i = 0; i <= x1 - x0; i++) {
+            uint32_t out = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t sum = (c[i] >> shift & 255) + (s1[i] >> shift & 255) + (s2[i] >> shift & 255) + (s3[i] >> shift & 255);
+                out |= (sum + 2) / 4 << shift;
+            }
+            c[i] = out;
+        }
+    }
+    expanded = 0;
+}
+
+// OIT 合成：平均颜色 = sum(颜色 * alpha * 权重) / sum(alpha * 权重)，按 1 - 透射率 盖在不透明结果上。
+// 只有一层时就是普通的 alpha 混合。MSAA 展开过的 tile 每个采样点都要合成 (半透明按像素累积，不分采样点)
+void Renderer::resolve_oit_tile(int x0, int y0, int x1, int y1) {
+    const bool expanded = !msaa_expanded.empty() && msaa_expanded[(y0 / TILE_SIZE) * tiles_x + x0 / TILE_SIZE];
+    for (int y = y0; y <= y1; y++) {
+        uint32_t* c = color_row(y, x0, y0);
+        const size_t row = pixel_index(y, x0, y0);
+        for (int x = 0; x <= x1 - x0; x++) {
+            const size_t i = row + x;
+            const float reveal = oit.reveal[i];
+            if (reveal >= 1.0f) continue;
+
+            const float cover = (1.0f - reveal) / std::max(oit.a[i], 1e-5f);
+            const float r = oit.r[i] * cover, g = oit.g[i] * cover, b = oit.b[i] * cover;
+            auto composite = [&](uint32_t& dst) {
+                float dst_r = (float)(dst >> 16 & 255), dst_g = (float)(dst >> 8 & 255), dst_b = (float)(dst & 255);
+                dst = pack_color((int)std::min(255.0f, r + dst_r * reveal),
+                                 (int)std::min(255.0f, g + dst_g * reveal),
+                                 (int)std::min(255.0f, b + dst_b * reveal));
+            };
+            composite(c[x]);
+            if (expanded) {
+                for (int s = 1; s < MSAA_SAMPLES; s++) composite(*sample_color(s, i));
+            }
+
+            oit.r[i] = oit.g[i] = oit.b[i] = oit.a[i] = 0.0f;
+            oit.reveal[i] = 1.0f;
+        }
+    }
+}
+
 // --- 画点 ---
 void Renderer::set_pixel(int x, int y, const Vector3i& color) {
     if (x < 0 || x >= width || y < 0 || y >= height) return;
-    int cv_y = height - 1 - y;
-    frame_buffer.at<Vec3b>(cv_y, x) = Vec3b(color.z(), color.y(), color.x());
+    color_buffer[(size_t)y * width + x] = pack_color(color.x(), color.y(), color.z());
 }
 
 // --- 画线 ---
@@ -116,208 +324,573 @@ void Renderer::draw_line(Vector2i p0, Vector2i p1, Vector3i color) {
     }
 }
 
-// --- 阴影图光栅化 (只记深度) ---
-void Renderer::rasterize_shadow(Vector3f v0, Vector3f v1, Vector3f v2) {
-    int min_x = (int)std::min({ v0.x(), v1.x(), v2.x() });
-    int max_x = (int)std::max({ v0.x(), v1.x(), v2.x() });
-    int min_y = (int)std::min({ v0.y(), v1.y(), v2.y() });
-    int max_y = (int)std::max({ v0.y(), v1.y(), v2.y() });
-
-    min_x = std::max(0, min_x); max_x = std::min(shadow_width - 1, max_x);
-    min_y = std::max(0, min_y); max_y = std::min(shadow_height - 1, max_y);
-
-    Vector2f t0 = v0.head<2>();
-    Vector2f t1 = v1.head<2>();
-    Vector2f t2 = v2.head<2>();
-
-    for (int x = min_x; x <= max_x; x++) {
-        for (int y = min_y; y <= max_y; y++) {
-            auto [a, b, c] = MathUtils::compute_barycentric((float)x + 0.5f, (float)y + 0.5f, t0, t1, t2);
-            // 双面渲染支持
-            if ((a >= 0 && b >= 0 && c >= 0) || (a <= 0 && b <= 0 && c <= 0)) {
-                float z = a * v0.z() + b * v1.z() + c * v2.z();
-                int index = y * shadow_width + x;
-                if (z < shadow_buffer[index]) {
-                    shadow_buffer[index] = z;
-                }
+// --- 三角形建立 ---
+
+// 向下取整的整数除法 (b > 0)
+static int64_t floor_div(int64_t a, int64_t b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+bool TriangleSetup::setup(const Vector2f& p0, const Vector2f& p1, const Vector2f& p2, int buf_w, int buf_h, bool use_fixed,
+                          CullMode cull, int radius) {
+    Vector2f t0 = p0, t1 = p1, t2 = p2;
+    fixed = false;
+    sample_radius = radius;
+
+    // 坐标太离谱 (还没做裁剪的近平面三角形) 时定点数会溢出，这种三角形退回浮点路径
+    const float fixed_limit = (float)(1 << FIXED_RANGE_BITS);
+    bool in_range = true;
+    for (const Vector2f* p : { &p0, &p1, &p2 }) {
+        in_range = in_range && std::abs(p->x()) < fixed_limit && std::abs(p->y()) < fixed_limit;
+    }
+
+    if (use_fixed && in_range) {
+        // 1. 顶点吸附到 1/16 像素网格
+        int64_t X[3], Y[3];
+        const Vector2f* src[3] = { &p0, &p1, &p2 };
+        for (int i = 0; i < 3; i++) {
+            X[i] = (int64_t)std::lround(src[i]->x() * SUBPIXEL_SCALE);
+            Y[i] = (int64_t)std::lround(src[i]->y() * SUBPIXEL_SCALE);
+        }
+
+        int64_t area_fx = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+        // y 轴向下，屏幕上逆时针 (正面) 的有向面积是负的
+        if (area_fx == 0) return false;
+        if (cull == CullMode::BACK && area_fx > 0) return false;
+        if (cull == CullMode::FRONT && area_fx < 0) return false;
+
+        // 2. 统一成有向面积为正 (屏幕上顺时针)，这样三条边函数在三角形内部都为正
+        int order[3] = { 0, 1, 2 };
+        if (area_fx < 0) std::swap(order[1], order[2]);
+
+        for (int i = 0; i < 3; i++) {
+            int P = order[i], Q = order[(i + 1) % 3];
+            int64_t dx = X[Q] - X[P], dy = Y[Q] - Y[P];
+
+            // Top-Left 规则：屏幕上顺时针时左边向上走 (dy < 0)，上边水平向右走 (dy == 0 && dx > 0)
+            // 只有上边/左边上的采样点算在里面，共享边只会被其中一个三角形画到
+            bool top_left = dy < 0 || (dy == 0 && dx > 0);
+            int64_t bias = top_left ? 0 : 1;
+
+            // E(X, Y) = dx * (Y - Y_P) - dy * (X - X_P)，采样点在像素中心 X = x * 16 + 8
+            // 换成整数像素坐标：E(x, y) = e_a * x + e_b * y + e_c
+            int64_t A = -dy, B = dx, C = dy * X[P] - dx * Y[P];
+            const int64_t half = SUBPIXEL_SCALE / 2;
+            e_a[i] = A * SUBPIXEL_SCALE;
+            e_b[i] = B * SUBPIXEL_SCALE;
+            e_c[i] = A * half + B * half + C - bias;
+        }
+
+        // 3. 精确包围盒：采样点 x * 16 + 8 (± radius) 落在 [min, max] 里的像素
+        int64_t min_X = std::min({ X[0], X[1], X[2] }), max_X = std::max({ X[0], X[1], X[2] });
+        int64_t min_Y = std::min({ Y[0], Y[1], Y[2] }), max_Y = std::max({ Y[0], Y[1], Y[2] });
+        const int64_t half = SUBPIXEL_SCALE / 2;
+        min_x = (int)std::max<int64_t>(0, -floor_div(half + radius - min_X, SUBPIXEL_SCALE));
+        max_x = (int)std::min<int64_t>(buf_w - 1, floor_div(max_X - half + radius, SUBPIXEL_SCALE));
+        min_y = (int)std::max<int64_t>(0, -floor_div(half + radius - min_Y, SUBPIXEL_SCALE));
+        max_y = (int)std::min<int64_t>(buf_h - 1, floor_div(max_Y - half + radius, SUBPIXEL_SCALE));
+        if (min_x > max_x || min_y > max_y) return false;
+
+        // 插值用吸附后的顶点，和覆盖测试保持一致
+        t0 = Vector2f(X[0], Y[0]) / (float)SUBPIXEL_SCALE;
+        t1 = Vector2f(X[1], Y[1]) / (float)SUBPIXEL_SCALE;
+        t2 = Vector2f(X[2], Y[2]) / (float)SUBPIXEL_SCALE;
+        fixed = true;
+    }
+
+    // 有向面积 (和 compute_barycentric 里的 area_total 一致)
+    float area = MathUtils::cross_product_2d(t0, t1, t2);
+    // 退化三角形直接丢弃 (顺便挡掉 NaN)
+    if (!(std::abs(area) > 0.0f)) return false;
+    if (cull == CullMode::BACK && area > 0) return false;
+    if (cull == CullMode::FRONT && area < 0) return false;
+
+    if (!fixed) {
+        // 按整个像素取包围盒，采样点不超出像素，MSAA 时也够用
+        min_x = std::max(0, (int)std::min({ t0.x(), t1.x(), t2.x() }));
+        max_x = std::min(buf_w - 1, (int)std::max({ t0.x(), t1.x(), t2.x() }));
+        min_y = std::max(0, (int)std::min({ t0.y(), t1.y(), t2.y() }));
+        max_y = std::min(buf_h - 1, (int)std::max({ t0.y(), t1.y(), t2.y() }));
+        if (min_x > max_x || min_y > max_y) return false;
+    }
+
+    // 边函数 E(p) = (B.x - A.x) * (p.y - A.y) - (B.y - A.y) * (p.x - A.x)
+    // a 对应边 v1->v2，b 对应边 v2->v0；除以面积后直接就是重心坐标
+    float inv_area = 1.0f / area;
+    a_dx = -(t2.y() - t1.y()) * inv_area;
+    a_dy = (t2.x() - t1.x()) * inv_area;
+    a_c = ((t2.y() - t1.y()) * t1.x() - (t2.x() - t1.x()) * t1.y()) * inv_area;
+
+    b_dx = -(t0.y() - t2.y()) * inv_area;
+    b_dy = (t0.x() - t2.x()) * inv_area;
+    b_c = ((t0.y() - t2.y()) * t2.x() - (t0.x() - t2.x()) * t2.y()) * inv_area;
+
+    // 亚像素三角形：包围盒不超过 2x2 像素时逐个像素测一下，一个都没盖住就不进队列
+    // (单个像素的块，没有 sample_radius 时四个角是同一个点，classify_block 只会返回 INSIDE / OUTSIDE；
+    //  MSAA 时按采样点的外接框测，偏保守)
+    if ((max_x - min_x + 1) * (max_y - min_y + 1) <= 4) {
+        bool covered = false;
+        for (int y = min_y; y <= max_y && !covered; y++) {
+            for (int x = min_x; x <= max_x && !covered; x++) {
+                covered = classify_block(x, y, x, y) != OUTSIDE;
             }
         }
+        if (!covered) return false;
     }
+    return true;
 }
 
-// --- 核心渲染函数 ---
-void Renderer::rasterize_triangle(Vector3f v0, Vector3f v1, Vector3f v2,
-    Vector2f uv0, Vector2f uv1, Vector2f uv2,
-    Vector3f n0, Vector3f n1, Vector3f n2,
-    Vector4f s0, Vector4f s1, Vector4f s2,
-    const cv::Mat& texture, bool is_face, float alpha) {
+TriangleSetup::Coverage TriangleSetup::classify_block(int x0, int y0, int x1, int y1, unsigned* inside_edges) const {
+    // 每条边记录 4 个角里有几个在里面
+    int in[3] = { 0, 0, 0 };
+
+    if (fixed) {
+        // 定点数：精确判断 (e_a / e_b 是每像素的步长，除以 16 就是每 1/16 像素的步长)
+        int64_t px[4] = { x0, x1, x0, x1 };
+        int64_t py[4] = { y0, y0, y1, y1 };
+        int64_t ox[4] = { -sample_radius, sample_radius, -sample_radius, sample_radius };
+        int64_t oy[4] = { -sample_radius, -sample_radius, sample_radius, sample_radius };
+        for (int i = 0; i < 4; i++) {
+            for (int e = 0; e < 3; e++) {
+                int64_t offset = (e_a[e] * ox[i] + e_b[e] * oy[i]) / SUBPIXEL_SCALE;
+                in[e] += e_a[e] * px[i] + e_b[e] * py[i] + e_c[e] + offset >= 0;
+            }
+        }
+    }
+    else {
+        const float r = (float)sample_radius / SUBPIXEL_SCALE;
+        float px[4] = { x0 + 0.5f - r, x1 + 0.5f + r, x0 + 0.5f - r, x1 + 0.5f + r };
+        float py[4] = { y0 + 0.5f - r, y0 + 0.5f - r, y1 + 0.5f + r, y1 + 0.5f + r };
+        for (int i = 0; i < 4; i++) {
+            float a = a_dx * px[i] + a_dy * py[i] + a_c;
+            float b = b_dx * px[i] + b_dy * py[i] + b_c;
+            float c = 1.0f - a - b;
+            in[0] += a >= 0; in[1] += b >= 0; in[2] += c >= 0;
+        }
+    }
+
+    if (inside_edges) {
+        *inside_edges = (in[0] == 4 ? 1u : 0u) | (in[1] == 4 ? 2u : 0u) | (in[2] == 4 ? 4u : 0u);
+    }
+    if (in[0] == 0 || in[1] == 0 || in[2] == 0) return OUTSIDE;
+    if (in[0] == 4 && in[1] == 4 && in[2] == 4) return INSIDE;
+    return PARTIAL;
+}
+
+// 把包围盒覆盖到的 tile 都记上这个三角形
+static void bin_triangle(std::vector<std::vector<uint32_t>>& bins, int tiles_x, const TriangleSetup& tri, uint32_t index) {
+    int tx0 = tri.min_x / Renderer::TILE_SIZE, tx1 = tri.max_x / Renderer::TILE_SIZE;
+    int ty0 = tri.min_y / Renderer::TILE_SIZE, ty1 = tri.max_y / Renderer::TILE_SIZE;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            bins[ty * tiles_x + tx].push_back(index);
+        }
+    }
+}
 
-    // 1. 包围盒
-    int min_x = (int)std::min({ v0.x(), v1.x(), v2.x() });
-    int max_x = (int)std::max({ v0.x(), v1.x(), v2.x() });
-    int min_y = (int)std::min({ v0.y(), v1.y(), v2.y() });
-    int max_y = (int)std::max({ v0.y(), v1.y(), v2.y() });
+// float -> 能按无符号整数比大小的键 (正数翻符号位，负数整体取反)
+static inline uint32_t float_sort_key(float f) {
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
 
-    min_x = std::max(0, min_x); max_x = std::min(width - 1, max_x);
-    min_y = std::max(0, min_y); max_y = std::min(height - 1, max_y);
+// LSD 基数排序 (按键升序，稳定)：每趟 8 位，共 4 趟；所有键在这一趟落进同一个桶时直接跳过。
+// tmp_keys / tmp_ids 是另一半缓冲，每趟交换一次，结果留在 keys / ids 里 (交换的是指针，容量都保留)
+static void radix_sort(std::vector<uint32_t>& keys, std::vector<uint32_t>& ids,
+                       std::vector<uint32_t>& tmp_keys, std::vector<uint32_t>& tmp_ids) {
+    const size_t n = keys.size();
+    if (n < 2) return;
+    tmp_keys.resize(n);
+    tmp_ids.resize(n);
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t offset[256] = {};
+        for (size_t i = 0; i < n; i++) offset[(keys[i] >> shift) & 0xFF]++;
+        if (offset[(keys[0] >> shift) & 0xFF] == n) continue;
+
+        size_t sum = 0;
+        for (int d = 0; d < 256; d++) {
+            size_t c = offset[d];
+            offset[d] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; i++) {
+            size_t dst = offset[(keys[i] >> shift) & 0xFF]++;
+            tmp_keys[dst] = keys[i];
+            tmp_ids[dst] = ids[i];
+        }
+        keys.swap(tmp_keys);
+        ids.swap(tmp_ids);
+    }
+}
 
-    Vector2f t0 = v0.head<2>();
-    Vector2f t1 = v1.head<2>();
-    Vector2f t2 = v2.head<2>();
+// SORTED：按从远到近排好，再分箱。同一深度保持提交顺序 (基数排序是稳定的)
+void Renderer::sort_transparent() {
+    radix_sort(sort_keys, sort_ids, sort_keys_tmp, sort_ids_tmp);
+    for (uint32_t idx : sort_ids) {
+        bin_triangle(sorted_bins, tiles_x, tri_queue[idx].setup, idx);
+    }
+}
 
-    for (int x = min_x; x <= max_x; x++) {
-        for (int y = min_y; y <= max_y; y++) {
+// --- 阴影图光栅化 (只记深度) ---
+void Renderer::rasterize_shadow(Vector3f v0, Vector3f v1, Vector3f v2) {
+    ShadowTriangle t;
+    if (!t.setup.setup(v0.head<2>(), v1.head<2>(), v2.head<2>(), shadow_width, shadow_height, false, cull_mode)) return;
+    t.z[0] = v0.z(); t.z[1] = v1.z(); t.z[2] = v2.z();
 
-            // 2. 重心坐标
-            auto [a, b, c] = MathUtils::compute_barycentric((float)x + 0.5f, (float)y + 0.5f, t0, t1, t2);
+    shadow_queue.push_back(t);
+    bin_triangle(shadow_bins, shadow_tiles_x, t.setup, (uint32_t)(shadow_queue.size() - 1));
+}
 
-            // 支持双面渲染 (只要符号一致)
-            if ((a >= 0 && b >= 0 && c >= 0) || (a <= 0 && b <= 0 && c <= 0)) {
+// 只画落在 [x0, x1] x [y0, y1] (一个 tile) 里的部分
+void Renderer::draw_shadow_triangle(const ShadowTriangle& t, int x0, int y0, int x1, int y1) {
+    const TriangleSetup& tri = t.setup;
+    int min_x = std::max(tri.min_x, x0), max_x = std::min(tri.max_x, x1);
+    int min_y = std::max(tri.min_y, y0), max_y = std::min(tri.max_y, y1);
+
+    for (int y = min_y; y <= max_y; y++) {
+        // 行优先遍历：每行只算一次起点，之后沿 x 方向加法步进，shadow_buffer 连续访问
+        float px = (float)min_x + 0.5f;
+        float py = (float)y + 0.5f;
+        float a = tri.a_dx * px + tri.a_dy * py + tri.a_c;
+        float b = tri.b_dx * px + tri.b_dy * py + tri.b_c;
+
+        if (shadow_format == DepthFormat::UNORM16) {
+            // 先量化再比较，和存进去的值在同一精度上做深度测试
+            const float scale = 65535.0f / (shadow_z_far - shadow_z_near);
+            uint16_t* row = &shadow_unorm[(size_t)y * shadow_width];
+            for (int x = min_x; x <= max_x; x++, a += tri.a_dx, b += tri.b_dx) {
+                float c = 1.0f - a - b;
+                if (a >= 0 && b >= 0 && c >= 0) {
+                    float z = (a * t.z[0] + b * t.z[1] + c * t.z[2] - shadow_z_near) * scale;
+                    uint16_t q = (uint16_t)(std::min(std::max(z, 0.0f), 65535.0f) + 0.5f);
+                    if (q < row[x]) {
+                        row[x] = q;
+                    }
+                }
+            }
+            continue;
+        }
 
-                // 3. 插值 Z
-                float z_current = a * v0.z() + b * v1.z() + c * v2.z();
-                int index = y * width + x;
+        float* row = &shadow_buffer[y * shadow_width];
+        for (int x = min_x; x <= max_x; x++, a += tri.a_dx, b += tri.b_dx) {
+            float c = 1.0f - a - b;
+            // 除以有向面积后与绕序无关，天然支持双面渲染
+            if (a >= 0 && b >= 0 && c >= 0) {
+                float z = a * t.z[0] + b * t.z[1] + c * t.z[2];
+                if (z < row[x]) {
+                    row[x] = z;
+                }
+            }
+        }
+    }
+}
 
-                // 4. 深度测试
-                if (z_current < z_buffer[index]) {
+// --- 核心渲染函数 (只负责建立三角形并分箱，真正的光栅化在 flush 里) ---
+void Renderer::rasterize_triangle(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2,
+    const cv::Mat& texture, bool is_face, float alpha) {
 
-                    // === A. 准备纹理颜色 ===
-                    float u = a * uv0.x() + b * uv1.x() + c * uv2.x();
-                    float v = a * uv0.y() + b * uv1.y() + c * uv2.y();
-                    u = std::min(1.0f, std::max(0.0f, u));
-                    v = std::min(1.0f, std::max(0.0f, v));
+    // 1. 三角形建立 (包围盒 + 边函数系数)，退化、背面、一个像素都没盖住的三角形直接跳过
+    RasterTriangle t;
+    if (!t.setup.setup(v0.pos.head<2>(), v1.pos.head<2>(), v2.pos.head<2>(), width, height, fixed_point, cull_mode,
+                       msaa ? MSAA_SAMPLE_RADIUS : 0)) return;
+
+    // 2. 深度和所有插值量都换成平面方程，之后就不再需要顶点数据
+    // 深度 (NDC z) 本身在屏幕空间是线性的；其余插值量要透视校正，先除以 w
+    t.setup.plane(v0.pos.z(), v1.pos.z(), v2.pos.z(), t.z_dx, t.z_dy, t.z_c);
+    t.z_min = std::min({ v0.pos.z(), v1.pos.z(), v2.pos.z() });
+    t.z_max = std::max({ v0.pos.z(), v1.pos.z(), v2.pos.z() });
+    t.setup.plane(v0.inv_w, v1.inv_w, v2.inv_w, t.inv_w_dx, t.inv_w_dy, t.inv_w_c);
+    for (int k = 0; k < VARYING_COUNT; k++) {
+        t.setup.plane(v0.varying[k] * v0.inv_w, v1.varying[k] * v1.inv_w, v2.varying[k] * v2.inv_w,
+                      t.var_dx[k], t.var_dy[k], t.var_c[k]);
+    }
+    t.is_face = is_face;
+    t.alpha = alpha;
 
-                    Vector3f tex_color;
+    // 同一个 mesh 的三角形连续提交，只和上一张比就能去重
+    if (frame_textures.empty() || frame_textures.back().data != texture.data) {
+        frame_textures.push_back(texture);
+    }
+    t.texture_slot = (int)frame_textures.size() - 1;
+
+    tri_queue.push_back(t);
+    const uint32_t idx = (uint32_t)(tri_queue.size() - 1);
+    if (transparency == TransparencyMode::SORTED && alpha <= 0.9f) {
+        // 键取三个顶点观察深度 (w) 的平均，取反后升序排序就是从远到近
+        float depth = (1.0f / v0.inv_w + 1.0f / v1.inv_w + 1.0f / v2.inv_w) / 3.0f;
+        sort_keys.push_back(~float_sort_key(depth));
+        sort_ids.push_back(idx);
+        return;
+    }
+    bin_triangle(tile_bins, tiles_x, t.setup, idx);
+}
 
-                    if (texture.empty()) {
-                        // 棋盘格逻辑 (地板)
-                        float scale = 10.0f;
-                        float check_u = u * scale;
-                        float check_v = v * scale;
-                        int parity = (int)(std::floor(check_u) + std::floor(check_v)) % 2;
+// 只画落在 [x0, x1] x [y0, y1] (一个 tile) 里的部分
+void Renderer::draw_triangle(const RasterTriangle& t, int x0, int y0, int x1, int y1, ShadingMode pass, int vis_id) {
+#ifdef SR_AVX2_KERNEL
+    if (use_avx2) {
+        draw_triangle_avx2(t, x0, y0, x1, y1, pass, vis_id);
+        return;
+    }
+#endif
+    draw_triangle_variant<float>(t, x0, y0, x1, y1, pass, vis_id);
+}
 
-                        if (parity == 0) tex_color = Vector3f(240, 240, 240);
-                        else             tex_color = Vector3f(180, 180, 190);
-                    }
-                    else {
-                        // 正常读图逻辑
-                        int tex_x = (int)(u * (texture.cols - 1));
-                        int tex_y = (int)((1.0f - v) * (texture.rows - 1));
-
-                        // 统一读 3 通道 BGR，安全第一
-                        cv::Vec3b color_bgr = texture.at<cv::Vec3b>(tex_y, tex_x);
-                        tex_color = Vector3f(color_bgr[2], color_bgr[1], color_bgr[0]);
-                    }
+void Renderer::resolve_visibility(int x0, int y0, int x1, int y1) {
+#ifdef SR_AVX2_KERNEL
+    if (use_avx2) {
+        resolve_visibility_avx2(x0, y0, x1, y1);
+        return;
+    }
+#endif
+    resolve_visibility_lanes<float>(x0, y0, x1, y1);
+}
 
-                    // === B. 阴影查表 (PCF) ===
-                    float shadow_factor = 1.0f;
+void Renderer::light_gbuffer(int x0, int y0, int x1, int y1) {
+#ifdef SR_AVX2_KERNEL
+    if (use_avx2) {
+        light_gbuffer_avx2(x0, y0, x1, y1);
+        return;
+    }
+#endif
+    light_gbuffer_lanes<float>(x0, y0, x1, y1);
+}
 
-                    // 脸部无阴影，地板阴影淡一点(0.7)，身体阴影(0.5)
-                    float shadow_intensity = texture.empty() ? 0.7f : 0.5f;
+// 辅助函数
+void Renderer::init_shadow_buffer(int w, int h, DepthFormat format, float z_near, float z_far) {
+    shadow_width = w;
+    shadow_height = h;
+    shadow_format = format;
+    shadow_z_near = z_near;
+    shadow_z_far = z_far;
+
+    shadow_tiles_x = (w + TILE_SIZE - 1) / TILE_SIZE;
+    shadow_tiles_y = (h + TILE_SIZE - 1) / TILE_SIZE;
+    shadow_bins.assign(shadow_tiles_x * shadow_tiles_y, {});
+    shadow_tile_state.assign(shadow_tiles_x * shadow_tiles_y, TILE_CLEARED);
+    shadow_queue.clear();
+    alloc_shadow_buffer();
+}
 
-                    
-                        Vector4f s_pos = a * s0 + b * s1 + c * s2;
-                        Vector3f s_ndc = s_pos.head<3>() / s_pos.w();
-                        float su = s_ndc.x() * 0.5f + 0.5f;
-                        float sv = s_ndc.y() * 0.5f + 0.5f;
-                        float sz = s_ndc.z() * 0.5f + 0.5f;
+// 只分配当前格式用的那一份，整片填清除值 (FLOAT32 是 float 最大值，UNORM16 是 z_far)
+void Renderer::alloc_shadow_buffer() {
+    size_t n = (size_t)shadow_width * shadow_height;
+    bool unorm = shadow_format == DepthFormat::UNORM16;
+    shadow_buffer.assign(unorm ? 0 : n, std::numeric_limits<float>::max());
+    shadow_unorm.assign(unorm ? n + 1 : 0, 0xFFFF);
+    std::fill(shadow_tile_state.begin(), shadow_tile_state.end(), TILE_CLEARED);
+}
 
-                        if (su >= 0 && su < 1 && sv >= 0 && sv < 1) {
-                            int sx = (int)(su * (shadow_width - 1));
-                            int sy = (int)(sv * (shadow_height - 1));
-                            int sidx = sy * shadow_width + sx;
+void Renderer::clear_shadow() {
+    size_t n = shadow_format == DepthFormat::UNORM16 ? shadow_unorm.size() - 1 : shadow_buffer.size();
+    if (n != (size_t)shadow_width * shadow_height) {
+        alloc_shadow_buffer();
+        return;
+    }
+    for (auto& state : shadow_tile_state) {
+        if (state == TILE_DIRTY) state = TILE_STALE;
+    }
+}
 
-                            // Shadow Bias (0.005) 防止自阴影
-                            if (sz - 0.005f > shadow_buffer[sidx]) {
-                                shadow_factor = shadow_intensity;
-                            }
-                        }
-                    
+// 把一个 tile 的深度 (含 TILED 的 z_linear、MSAA 的其余采样点、Hi-Z) 写回清除值
+void Renderer::clear_depth_tile(int tile) {
+    int x0 = (tile % tiles_x) * TILE_SIZE, y0 = (tile / tiles_x) * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, width) - 1, y1 = std::min(y0 + TILE_SIZE, height) - 1;
+    const int w = x1 - x0 + 1;
+    const float inf = std::numeric_limits<float>::infinity();
+    for (int y = y0; y <= y1; y++) {
+        std::fill_n(depth_row(y, x0, y0), w, inf);
+        if (layout == BufferLayout::TILED) std::fill_n(&z_linear[(size_t)y * width + x0], w, inf);
+        if (!msaa_z.empty()) {
+            const size_t row = pixel_index(y, x0, y0);
+            for (int s = 1; s < MSAA_SAMPLES; s++) std::fill_n(sample_depth(s, row), w, inf);
+        }
+    }
+    for (int by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++) {
+        std::fill_n(&hiz_block[by * blocks_x + x0 / BLOCK_SIZE], x1 / BLOCK_SIZE - x0 / BLOCK_SIZE + 1, inf);
+        std::fill_n(&hiz_block_min[by * blocks_x + x0 / BLOCK_SIZE], x1 / BLOCK_SIZE - x0 / BLOCK_SIZE + 1, inf);
+    }
+    hiz_tile[tile] = inf;
+    hiz_tile_min[tile] = inf;
+}
 
-                    // === C. 卡通光照 (Toon Shading) ===
-                    Vector3f normal = (a * n0 + b * n1 + c * n2).normalized();
-                    Vector3f light_dir = Vector3f(1.0f, 1.0f, 1.0f).normalized();
+void Renderer::clear_shadow_tile(int tile) {
+    int x0 = (tile % shadow_tiles_x) * TILE_SIZE, y0 = (tile / shadow_tiles_x) * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, shadow_width) - 1, y1 = std::min(y0 + TILE_SIZE, shadow_height) - 1;
+    for (int y = y0; y <= y1; y++) {
+        size_t row = (size_t)y * shadow_width + x0;
+        if (shadow_format == DepthFormat::UNORM16) std::fill_n(&shadow_unorm[row], x1 - x0 + 1, (uint16_t)0xFFFF);
+        else std::fill_n(&shadow_buffer[row], x1 - x0 + 1, std::numeric_limits<float>::max());
+    }
+}
 
-                    float NdotL = std::max(0.0f, normal.dot(light_dir));
+void Renderer::set_thread_count(int n) {
+    pool = std::make_unique<ThreadPool>(n);
+}
 
-                    Vector3f light_color;
+void Renderer::set_fixed_point(bool enabled) {
+    fixed_point = enabled;
+}
 
-                    if (is_face) {
-                        light_color = Vector3f(1.0f, 1.0f, 1.0f); // 脸部恒亮
-                    }
-                    else {
-                        // 身体/衣服：二值化光照
-                        if (NdotL > 0.5f) {
-                            light_color = Vector3f(1.0f, 1.0f, 1.0f); // 亮部
-                        }
-                        else {
-                            // 🟢【画质提升】暗部不要死黑，用蓝紫色环境光
-                            light_color = Vector3f(0.6f, 0.6f, 0.75f);
-                        }
-                    }
+void Renderer::set_shading_mode(ShadingMode mode) {
+    shading = mode;
+    resize_shading_buffers();
+}
 
-                    // 叠加阴影
-                    // 如果在阴影里，强制把颜色变暗 (乘上冷色调阴影)
-                    if (shadow_factor < 0.9f) {
-                        light_color = light_color.cwiseProduct(Vector3f(0.6f, 0.6f, 0.75f));
-                    }
+void Renderer::set_transparency_mode(TransparencyMode mode) {
+    transparency = mode;
+    resize_shading_buffers();
+}
 
-                    // === D. 边缘光 (Rim Light) ===
-                    Vector3f rim_color(0, 0, 0);
-                    if (!is_face && alpha > 0.9f) {
-                        Vector3f view_dir(0, 0, 1);
-                        float NdotV = normal.dot(view_dir);
-                        float rim = std::pow(1.0f - std::max(0.0f, NdotV), 4.0f);
-                        if (rim > 0.4f) rim = 1.0f; else rim = 0.0f; // 硬边缘
-                        rim_color = Vector3f(50, 50, 80) * rim; // 淡淡的蓝光
-                    }
+void Renderer::set_cull_mode(CullMode mode) {
+    cull_mode = mode;
+}
 
-                    // === E. 组合最终颜色 ===
-                    // 纹理 * 光照 + 边缘光
-                    Vector3f final_color = tex_color.cwiseProduct(light_color) + rim_color;
+void Renderer::set_toon_params(const ToonParams& params) {
+    toon = params;
+    toon.light_dir.normalize();
+}
 
-                    // === F. 写入像素 ===
+// 只给当前模式分配缓冲，大小跟着 z_buffer 走 (TILED 时有填充)
+void Renderer::resize_shading_buffers() {
+    size_t n = shading == ShadingMode::VISIBILITY ? z_buffer.size() : 0;
+    vis_buffer.assign(n, -1);
 
-                    // 不透明 (Body/Face) -> 写 Z，覆盖颜色
-                    if (alpha > 0.9f) {
-                        z_buffer[index] = z_current;
+    n = shading == ShadingMode::DEFERRED ? z_buffer.size() : 0;
+    gbuffer.albedo.assign(n, 0);
+    for (auto* plane : { &gbuffer.nx, &gbuffer.ny, &gbuffer.nz, &gbuffer.su, &gbuffer.sv, &gbuffer.sz, &gbuffer.material }) {
+        plane->assign(n, 0.0f);
+    }
 
-                        final_color.x() = std::min(255.0f, final_color.x());
-                        final_color.y() = std::min(255.0f, final_color.y());
-                        final_color.z() = std::min(255.0f, final_color.z());
-                        set_pixel(x, y, final_color.cast<int>());
-                    }
-                    // 半透明 (Glass) -> 不写 Z，混合颜色
-                    else {
-                        int cv_y = height - 1 - y;
-                        cv::Vec3b bg_val = frame_buffer.at<cv::Vec3b>(cv_y, x);
-                        Vector3f bg_color(bg_val[2], bg_val[1], bg_val[0]);
-
-                        Vector3f blended = final_color * alpha + bg_color * (1.0f - alpha);
-
-                        blended.x() = std::min(255.0f, blended.x());
-                        blended.y() = std::min(255.0f, blended.y());
-                        blended.z() = std::min(255.0f, blended.z());
-                        set_pixel(x, y, blended.cast<int>());
-                    }
-                }
-            }
-        }
+    n = transparency == TransparencyMode::WEIGHTED_OIT ? z_buffer.size() : 0;
+    for (auto* plane : { &oit.r, &oit.g, &oit.b, &oit.a }) {
+        plane->assign(n, 0.0f);
     }
+    oit.reveal.assign(n, 1.0f);
+
+    n = msaa && shading == ShadingMode::FORWARD ? z_buffer.size() * (MSAA_SAMPLES - 1) : 0;
+    msaa_z.assign(n, std::numeric_limits<float>::infinity());
+    msaa_color.assign(n, 0);
+    msaa_expanded.assign(n ? tiles_x * tiles_y : 0, 0);
 }
 
-// 辅助函数
-void Renderer::init_shadow_buffer(int w, int h) {
-    shadow_width = w;
-    shadow_height = h;
-    shadow_buffer.resize(w * h);
-    std::fill(shadow_buffer.begin(), shadow_buffer.end(), std::numeric_limits<float>::max());
+void Renderer::set_hiz_enabled(bool enabled) {
+    hiz_enabled = enabled;
 }
 
-void Renderer::clear_shadow() {
-    if (shadow_buffer.size() != shadow_width * shadow_height) {
-        shadow_buffer.resize(shadow_width * shadow_height);
-    }
-    std::fill(shadow_buffer.begin(), shadow_buffer.end(), std::numeric_limits<float>::max());
+void Renderer::set_msaa_enabled(bool enabled) {
+    msaa = enabled;
+    std::fill(z_buffer.begin(), z_buffer.end(), std::numeric_limits<float>::infinity());
+    std::fill(hiz_block.begin(), hiz_block.end(), std::numeric_limits<float>::infinity());
+    std::fill(hiz_block_min.begin(), hiz_block_min.end(), std::numeric_limits<float>::infinity());
+    std::fill(hiz_tile.begin(), hiz_tile.end(), std::numeric_limits<float>::infinity());
+    std::fill(hiz_tile_min.begin(), hiz_tile_min.end(), std::numeric_limits<float>::infinity());
+    std::fill(depth_tile_state.begin(), depth_tile_state.end(), TILE_CLEARED);
+    resize_shading_buffers();
+}
+
+void Renderer::set_simd_enabled(bool enabled) {
+#ifdef SR_AVX2_KERNEL
+    use_avx2 = enabled && Simd::cpu_has_avx2();
+#else
+    use_avx2 = false;
+#endif
 }
 
+// --- Tile 并行光栅化 ---
+void Renderer::flush_shadow() {
+    // 队列空时也要走一遍：上一帧画过的 tile 还等着清
+    pool->parallel_for(shadow_tiles_x * shadow_tiles_y, [&](int tile) {
+        unsigned char& state = shadow_tile_state[tile];
+        if (state == TILE_STALE) {
+            clear_shadow_tile(tile);
+            state = TILE_CLEARED;
+        }
+        if (shadow_bins[tile].empty()) return;
+        state = TILE_DIRTY;
+
+        int x0 = (tile % shadow_tiles_x) * TILE_SIZE;
+        int y0 = (tile / shadow_tiles_x) * TILE_SIZE;
+        int x1 = std::min(x0 + TILE_SIZE, shadow_width) - 1;
+        int y1 = std::min(y0 + TILE_SIZE, shadow_height) - 1;
+        for (uint32_t idx : shadow_bins[tile]) {
+            draw_shadow_triangle(shadow_queue[idx], x0, y0, x1, y1);
+        }
+    });
+
+    // clear() 保留容量，下一帧不用重新分配
+    for (auto& bin : shadow_bins) bin.clear();
+    shadow_queue.clear();
+}
+
+void Renderer::flush() {
+    // 主画面要查阴影图，所以阴影必须先画完
+    flush_shadow();
+
+    if (!sort_ids.empty()) sort_transparent();
+
+    pool->parallel_for(tiles_x * tiles_y, [&](int tile) {
+        // 第一次碰到这个 tile 时才真正清深度；没三角形的 tile 也在这里清掉，flush 之后读到的都是清除值
+        unsigned char& state = depth_tile_state[tile];
+        if (state == TILE_STALE) {
+            clear_depth_tile(tile);
+            state = TILE_CLEARED;
+        }
+        if (tile_bins[tile].empty() && sorted_bins[tile].empty()) return;
+        state = TILE_DIRTY;
+
+        int x0 = (tile % tiles_x) * TILE_SIZE;
+        int y0 = (tile / tiles_x) * TILE_SIZE;
+        int x1 = std::min(x0 + TILE_SIZE, width) - 1;
+        int y1 = std::min(y0 + TILE_SIZE, height) - 1;
+
+        const bool oit_pass = transparency == TransparencyMode::WEIGHTED_OIT;
+        if (layout == BufferLayout::TILED) load_color_tile(tile);
+        if (shading == ShadingMode::FORWARD && !oit_pass) {
+            for (uint32_t idx : tile_bins[tile]) {
+                draw_triangle(tri_queue[idx], x0, y0, x1, y1);
+            }
+        }
+        else if (shading == ShadingMode::FORWARD) {
+            // OIT 的深度测试要对着完整的不透明深度做，所以先画完所有不透明的
+            for (uint32_t idx : tile_bins[tile]) {
+                if (tri_queue[idx].alpha > 0.9f) draw_triangle(tri_queue[idx], x0, y0, x1, y1);
+            }
+            for (uint32_t idx : tile_bins[tile]) {
+                if (tri_queue[idx].alpha <= 0.9f) draw_triangle(tri_queue[idx], x0, y0, x1, y1);
+            }
+        }
+        else {
+            // 编号 / G-buffer 只在本批次内有效，先把这个 tile 的清掉
+            for (int y = y0; y <= y1; y++) {
+                size_t row = pixel_index(y, x0, y0);
+                if (shading == ShadingMode::VISIBILITY) std::fill_n(&vis_buffer[row], x1 - x0 + 1, -1);
+                else std::fill_n(&gbuffer.material[row], x1 - x0 + 1, 0.0f);
+            }
+            // 1. 不透明：只写深度 + 编号 / G-buffer  2. 对可见像素统一着色  3. 半透明混合 (或 OIT 累积)
+            for (uint32_t idx : tile_bins[tile]) {
+                if (tri_queue[idx].alpha > 0.9f) draw_triangle(tri_queue[idx], x0, y0, x1, y1, shading, (int)idx);
+            }
+            if (shading == ShadingMode::VISIBILITY) resolve_visibility(x0, y0, x1, y1);
+            else light_gbuffer(x0, y0, x1, y1);
+            for (uint32_t idx : tile_bins[tile]) {
+                if (tri_queue[idx].alpha <= 0.9f) draw_triangle(tri_queue[idx], x0, y0, x1, y1);
+            }
+        }
+        // SORTED：半透明不在 tile_bins 里，等这个 tile 的不透明全部画完再从远到近混合
+        for (uint32_t idx : sorted_bins[tile]) {
+            draw_triangle(tri_queue[idx], x0, y0, x1, y1);
+        }
+        if (oit_pass) resolve_oit_tile(x0, y0, x1, y1);
+        if (!msaa_z.empty()) resolve_msaa_tile(x0, y0, x1, y1);
+        if (layout == BufferLayout::TILED) resolve_tile(tile);
+    });
+
+    for (auto& bin : tile_bins) bin.clear();
+    for (auto& bin : sorted_bins) bin.clear();
+    sort_keys.clear();
+    sort_ids.clear();
+    tri_queue.clear();
+    frame_textures.clear();
+}
@@ -3,11 +3,122 @@
 #include <Eigen/Dense>
 #include <vector>
 #include <cmath>
+#include <cstdint>
+#include <memory>
 #include "Skybox.h" 
+#include "ThreadPool.h"
+#include "Varyings.h"
 
 using namespace cv;
 using namespace Eigen;
 
+// 剔除模式 (正面 = 屏幕上看是逆时针，和 OpenGL 默认一致)
+// 屏幕空间和 OpenCV 一样 y 轴向下 (第 0 行在最上面)，视口变换时就翻转好，光栅化和写缓冲不再翻转
+enum class CullMode { NONE, BACK, FRONT };
+
+// 三角形建立 (Triangle Setup)：每个三角形只算一次边函数系数，
+// 像素循环里按行/列做加法步进，不再逐像素调用 compute_barycentric
+struct TriangleSetup {
+    // 重心坐标是屏幕坐标的线性函数：a(x, y) = a_dx * x + a_dy * y + a_c，c = 1 - a - b
+    float a_dx, a_dy, a_c;
+    float b_dx, b_dy, b_c;
+
+    // 包围盒 (已裁剪到缓冲区范围内)
+    int min_x, max_x, min_y, max_y;
+
+    // 定点数边函数 (4 位亚像素精度 + Top-Left 规则)：E_i(x, y) = e_a * x + e_b * y + e_c >= 0 即覆盖
+    // x, y 是整数像素坐标，采样点偏移和 Top-Left 偏置都已经折进 e_c 里
+    static const int SUBPIXEL_BITS = 4;
+    static const int SUBPIXEL_SCALE = 1 << SUBPIXEL_BITS;
+    static const int FIXED_RANGE_BITS = 17; // 顶点坐标超过 ±2^17 像素时退回浮点路径
+    bool fixed;
+    int64_t e_a[3], e_b[3], e_c[3];
+
+    // 采样点离像素中心最远的距离 (1/16 像素为单位)，0 = 每像素只在中心采样一次
+    // MSAA 时包围盒和块级粗测都要按所有采样点外扩
+    int sample_radius;
+
+    // 返回 false 表示这个三角形不用画：面积为 0 (退化)、被 cull 剔除、包围盒为空，
+    // 或者是很小的三角形、一个采样点都没盖住
+    // use_fixed = true 时顶点先吸附到 1/16 像素，覆盖测试走整数
+    bool setup(const Vector2f& t0, const Vector2f& t1, const Vector2f& t2, int buf_w, int buf_h, bool use_fixed,
+               CullMode cull = CullMode::NONE, int radius = 0);
+
+    // 块级粗测：只在块四个角求边函数 (线性函数的极值一定在角上)，有 sample_radius 时角再往外扩
+    // OUTSIDE = 整块 (所有采样点) 在某条边外面，直接跳过；INSIDE = 整块在三角形里，不用逐像素测覆盖
+    // inside_edges 返回整块都在内侧的边 (bit i 对应第 i 条边)
+    enum Coverage { OUTSIDE, PARTIAL, INSIDE };
+    Coverage classify_block(int x0, int y0, int x1, int y1, unsigned* inside_edges = nullptr) const;
+
+    // 三个顶点上的值 f0, f1, f2 -> 屏幕空间平面方程 f(x, y) = dx * x + dy * y + c
+    void plane(float f0, float f1, float f2, float& dx, float& dy, float& c) const {
+        float d0 = f0 - f2, d1 = f1 - f2;
+        dx = a_dx * d0 + b_dx * d1;
+        dy = a_dy * d0 + b_dy * d1;
+        c = f2 + a_c * d0 + b_c * d1;
+    }
+};
+
+// 排队等待光栅化的三角形 (sort-middle：先按屏幕 tile 分箱，flush 时各 tile 并行光栅化)
+// 顶点数据在建立阶段就换成了平面方程，按系数种类分开存 (SoA)，内核里按槽位循环
+struct RasterTriangle {
+    TriangleSetup setup;
+    float z_dx, z_dy, z_c;
+    float z_min, z_max; // Hi-Z 用
+    // 透视校正：插值的是 varying / w 和 1 / w，逐像素除回来
+    float inv_w_dx, inv_w_dy, inv_w_c;
+    float var_dx[VARYING_COUNT], var_dy[VARYING_COUNT], var_c[VARYING_COUNT];
+    int texture_slot; // frame_textures 里的下标
+    bool is_face;
+    float alpha;
+};
+
+struct ShadowTriangle {
+    TriangleSetup setup;
+    float z[3];
+};
+
+// 主画面的着色方式
+//   FORWARD    : 光栅化时直接着色 (被挡住的片元也要付全部着色代价)
+//   VISIBILITY : 不透明三角形先只写深度 + 三角形编号，每个 tile 画完后对可见像素统一着色一次
+//   DEFERRED   : 不透明三角形先写 G-buffer (反照率、法线、阴影图坐标、材质)，光照作为全屏 pass 单独做
+// 后两种模式下半透明三角形最后照常按提交顺序混合
+enum class ShadingMode { FORWARD, VISIBILITY, DEFERRED };
+
+// 半透明 (alpha <= 0.9) 的合成方式
+//   ORDERED      : 按提交顺序直接和颜色缓冲混合，结果依赖三角形顺序 (重叠的半透明面顺序不对时会错)
+//   WEIGHTED_OIT : 加权混合 OIT。半透明片元只往累积缓冲里加 (颜色 * alpha * 权重、alpha * 权重、透射率连乘)，
+//                  每个 tile 画完后一次合成，和提交顺序无关，不用排序；权重随观察深度衰减，近的层占比更大
+//   SORTED       : 每帧把半透明三角形按观察深度 (三个顶点 w 的平均) 基数排序一次，不透明画完后从远到近混合。
+//                  结果精确，代价线性；只有互相穿插的三角形还会错 (按整个三角形排序，不拆片元)
+enum class TransparencyMode { ORDERED, WEIGHTED_OIT, SORTED };
+
+// 卡通光照参数 (前向和延迟共用)
+struct ToonParams {
+    Vector3f light_dir = Vector3f(1, 1, 1).normalized();
+    float lit_threshold = 0.5f; // N·L 超过它算亮部
+    float rim_threshold = 0.4f; // (1 - N·V)^4 超过它画边缘光
+};
+
+// 颜色/深度缓冲的内存布局
+//   LINEAR : 普通行优先，color_buffer 直接就是显示用的图
+//   TILED  : 每个 64x64 tile 连续存放 (tile 内行优先)，光栅化时一个 tile 只占连续的 16KB 深度 + 16KB 颜色，
+//            flush 结束时逐 tile 解析 (resolve) 回行优先的 frame_buffer / 深度图
+// tile 内不用 Morton 交错：那样一行连续 8 个像素就不连续了，AVX2 内核没法整段读写
+enum class BufferLayout { LINEAR, TILED };
+
+// 阴影图的深度格式
+//   FLOAT32 : 每像素一个 float
+//   UNORM16 : [z_near, z_far] 线性量化成 16 位整数，带宽减半 (2048x2048 从 16MB 降到 8MB)；
+//             范围取光源视锥时精度约 1/65535，远小于阴影查询的 0.005 偏移，超出范围的深度钳到边界
+enum class DepthFormat { FLOAT32, UNORM16 };
+
+// 4x MSAA 的采样点 (旋转网格)，相对像素中心的偏移，单位 1/16 像素 (和定点数亚像素精度一致)
+// 0 号采样点存在原来的 z_buffer / 颜色缓冲里，1~3 号存在 MSAA 专用的采样平面里
+static const int MSAA_SAMPLES = 4;
+static const int MSAA_SAMPLE_OFFSET[MSAA_SAMPLES][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+static const int MSAA_SAMPLE_RADIUS = 6;
+
 class Renderer {
 public:
     // 构造函数 (统一用 int)
@@ -22,18 +133,22 @@ public:
     // 画实心三角形 (3D版本，带深度)
     void rasterize_triangle(Vector3f v0, Vector3f v1, Vector3f v2, Vector3i color);
 
+    // 主画面三角形：顶点着色器的输出 (屏幕坐标 + varyings)
+    void rasterize_triangle(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2,
+        const cv::Mat& texture, bool is_face, float alpha = 1.0f);
+
     // 画彩色三角形 (2D版本，测试用)
     void rasterize_triangle_test(Vector2i v0, Vector2i v1, Vector2i v2);
 
+    // 显示用的 BGRA 图 (CV_8UC4)，直接包着 color_buffer，不拷贝
     Mat& get_frame_buffer();
-	const std::vector<float>& get_z_buffer() const { return z_buffer; }
-    void rasterize_triangle(Vector3f v0, Vector3f v1, Vector3f v2,
-        Vector2f uv0, Vector2f uv1, Vector2f uv2,
-        Vector3f n0, Vector3f n1, Vector3f n2,
-        Vector4f s0, Vector4f s1, Vector4f s2,
-        const cv::Mat& texture,bool is_face, float alpha=1.0f);
+    // 把画好的颜色缓冲整块换出去 (只交换指针，不拷贝)，换进来的缓冲接着画下一帧。
+    // 换进来的内容无所谓，clear() 会整片重写；大小不对时按画面大小重新分配
+    void swap_color_buffer(std::vector<uint32_t>& buffer);
+	const std::vector<float>& get_z_buffer() const { return layout == BufferLayout::TILED ? z_linear : z_buffer; }
 
-    void init_shadow_buffer(int w, int h);
+    // z_near / z_far 只对 UNORM16 有用：rasterize_shadow 传进来的深度在这个范围内才能精确保存
+    void init_shadow_buffer(int w, int h, DepthFormat format = DepthFormat::FLOAT32, float z_near = 0.0f, float z_far = 1.0f);
 
     void rasterize_shadow(Vector3f v0, Vector3f v1, Vector3f v2);
 
@@ -41,15 +156,187 @@ public:
 
     void clear_shadow();
 
+    // 把排队的三角形按 tile 并行光栅化 (先阴影图，再主画面)
+    // 读 z_buffer / frame_buffer 之前必须调用
+    void flush();
+
+    // 第 (bx, by) 个 8x8 块里深度的下界 / 上界 (MSAA 时包含所有采样点)，flush 之后有效
+    // 后期处理可以拿它整块跳过：比如块里深度几乎不变就不可能有描边
+    void get_block_depth_range(int bx, int by, float& z_min, float& z_max) const;
+
+    // 光栅化线程数 (<= 0 为全部硬件线程)
+    void set_thread_count(int n);
+
+    // 切换缓冲布局 (默认 LINEAR)，会清空当前画面
+    void set_buffer_layout(BufferLayout l);
+
+    // 定点数光栅化 (默认开启)：整数边函数 + Top-Left 规则，共享边上的像素只画一次，结果与线程数无关
+    void set_fixed_point(bool enabled);
+
+    // 是否使用 AVX2 8 像素内核 (CPU 不支持时始终走标量版本)
+    void set_simd_enabled(bool enabled);
+
+    // 着色方式 (默认 FORWARD)，见 ShadingMode
+    void set_shading_mode(ShadingMode mode);
+
+    // 半透明合成方式 (默认 ORDERED)，见 TransparencyMode；要在提交三角形之前设置
+    void set_transparency_mode(TransparencyMode mode);
+
+    // 剔除模式 (默认 NONE)，对之后提交的三角形 (主画面和阴影) 生效
+    // 单面材质用 BACK，双面材质 (头发、裙子) 切回 NONE
+    void set_cull_mode(CullMode mode);
+
+    // 光照参数，下一次 flush 起生效
+    void set_toon_params(const ToonParams& params);
+
+    // Hi-Z 粗深度剔除 (默认开启)：被已画内容完全挡住的三角形 / 8x8 块直接跳过
+    void set_hiz_enabled(bool enabled);
+
+    // 4x MSAA (默认关闭)：覆盖和深度按采样点存，着色每像素只做一次，flush 结束时按 tile 解析成最终颜色
+    // 只对 FORWARD 着色方式生效；会清空深度缓冲，要在提交三角形之前调用 (包围盒按采样点外扩)
+    void set_msaa_enabled(bool enabled);
+
+    static const int TILE_SIZE = 64;
+    static const int BLOCK_SIZE = 8; // tile 内再切 8x8 的块做粗测
+
 private:
     int width;  // 【修正】用 int
     int height; // 【修正】用 int
+    // 颜色缓冲：行优先，每像素一个打包的 32 位 BGRA，光栅化直接整组读写
+    // frame_buffer 只是包在它外面的 Mat 头 (给 OpenCV 显示和画线用)
+    std::vector<uint32_t> color_buffer;
     Mat frame_buffer;
-    std::vector<float> z_buffer; // 深度缓冲
+    std::vector<float> z_buffer; // 深度缓冲 (TILED 时按 tile 存放)
+
+    BufferLayout layout = BufferLayout::LINEAR;
+    std::vector<uint32_t> color_tiles;      // TILED 时光栅化写这里 (BGRA)，flush 后解析回 color_buffer
+    std::vector<float> z_linear;            // TILED 时解析出来的行优先深度，给 get_z_buffer 用
+
+    // 第 y 行在 (tile_x0, tile_y0) 所在 tile 里的起始地址 (对应 x = tile_x0)
+    float* depth_row(int y, int tile_x0, int tile_y0);
+    uint32_t* color_row(int y, int tile_x0, int tile_y0);
+    // 同一像素在 z_buffer (以及编号缓冲、G-buffer) 里的下标
+    size_t pixel_index(int y, int tile_x0, int tile_y0);
+    void load_color_tile(int tile);
+    void resolve_tile(int tile);
+
+    // --- Hi-Z ---
+    // 两级深度范围：每个 8x8 块一对值，每个 tile 一对值 (= 块的最小 / 最大值)
+    // 新片元的深度 >= 最大值时一定过不了深度测试 (剔除)；< 最小值时一定能过，不用读逐像素深度 (直接接受)。
+    // 和 z_buffer 一样按 tile 独占，写时不用加锁。hiz_enabled 只管剔除 / 接受，范围本身一直维护
+    int blocks_x, blocks_y;
+    std::vector<float> hiz_block, hiz_block_min;
+    std::vector<float> hiz_tile, hiz_tile_min;
+    bool hiz_enabled = true;
+    // 块里写过深度之后重新统计块的最小 / 最大值；返回新的最大值
+    float update_hiz_block(int bx, int by, int x0, int y0, int x1, int y1);
+    void update_hiz_tile(int x0, int y0, int x1, int y1);
+
+    // --- 快速清除 ---
+    // clear() / clear_shadow() 不再整片写无穷远，只给画过的 tile 打标记；
+    // 真正的清除推迟到 flush 里由负责这个 tile 的线程去做 (有三角形时正好顺便预热缓存)。
+    // flush 结束时所有 tile 都已落实，get_z_buffer / 阴影查询读到的没画过的区域就是清除值
+    enum TileClearState : unsigned char {
+        TILE_CLEARED,   // 内存里已经是清除值
+        TILE_DIRTY,     // 本帧画过
+        TILE_STALE      // 上一帧画过、这一帧已经 clear，内存还没清
+    };
+    std::vector<unsigned char> depth_tile_state;  // 主画面：z_buffer (+ z_linear / MSAA 深度 / Hi-Z)
+    std::vector<unsigned char> shadow_tile_state; // 阴影图
+    void clear_depth_tile(int tile);
+    void clear_shadow_tile(int tile);
+
+    // --- 着色方式 ---
+    ShadingMode shading = ShadingMode::FORWARD;
+    ToonParams toon;
+
+    // 可见性缓冲：和 z_buffer 同样的布局，存 tri_queue 里的下标 (-1 = 本批次没画到)
+    std::vector<int> vis_buffer;
+
+    // G-buffer：和 z_buffer 同样的布局，每个量一个平面 (SoA)，光照 pass 可以整段向量读取
+    struct GBuffer {
+        std::vector<uint32_t> albedo;       // BGRA，和 color_buffer 一样
+        std::vector<float> nx, ny, nz;      // 单位法线
+        std::vector<float> su, sv, sz;      // 阴影图坐标 [0,1]
+        std::vector<float> material;        // 0 = 本批次没画到，1 = 身体/衣服，2 = 脸
+    } gbuffer;
+    void resize_shading_buffers();
+
+    // --- 加权混合 OIT ---
+    // 累积缓冲：和 z_buffer 同样的布局，每个量一个平面。平时保持 (0, 0, 0, 0, 1)，
+    // resolve_oit_tile 合成完就地复位，所以不用每帧清
+    TransparencyMode transparency = TransparencyMode::ORDERED;
+    struct OitBuffer {
+        std::vector<float> r, g, b;  // sum(颜色 * alpha * 权重)
+        std::vector<float> a;        // sum(alpha * 权重)
+        std::vector<float> reveal;   // prod(1 - alpha)：背景还能透出来多少
+    } oit;
+    void resolve_oit_tile(int x0, int y0, int x1, int y1);
+
+    // --- 半透明排序 (SORTED) ---
+    // 半透明三角形不进 tile_bins，提交时只记 (深度键, tri_queue 下标)；flush 时整体基数排序一次，
+    // 再按从远到近的顺序分进 sorted_bins。这些数组每帧 clear() 保留容量，热起来以后不再分配
+    std::vector<uint32_t> sort_keys, sort_ids;
+    std::vector<uint32_t> sort_keys_tmp, sort_ids_tmp; // 基数排序的另一半缓冲，和上面两个轮流当输入 / 输出
+    std::vector<std::vector<uint32_t>> sorted_bins;
+    void sort_transparent();
+
+    // --- MSAA ---
+    // 采样点 1~3 的深度 / 颜色，和 z_buffer 同样的布局，一个采样点一个平面
+    // 颜色按 tile 压缩：tile 里每个像素的采样点都来自同一个片元时只写 0 号采样点 (其余隐含相同)，
+    // 第一次出现部分覆盖的像素才把整个 tile 展开到所有采样平面 (msaa_expanded)
+    bool msaa = false;
+    std::vector<float> msaa_z;
+    std::vector<uint32_t> msaa_color;
+    std::vector<unsigned char> msaa_expanded; // 每个 tile 一个标记，只由负责这个 tile 的线程读写
+    // 第 s 号采样点在 pixel_index 为 i 处的深度 / 颜色 (s = 0 就是 z_buffer / color_row)
+    float* sample_depth(int s, size_t i) { return &msaa_z[((size_t)(s - 1) * z_buffer.size() + i)]; }
+    uint32_t* sample_color(int s, size_t i) { return &msaa_color[(size_t)(s - 1) * z_buffer.size() + i]; }
+    void expand_msaa_tile(int x0, int y0, int x1, int y1);
+    void resolve_msaa_tile(int x0, int y0, int x1, int y1);
 
     int shadow_width;
     int shadow_height;
-    std::vector<float> shadow_buffer;
+    DepthFormat shadow_format = DepthFormat::FLOAT32;
+    float shadow_z_near = 0.0f, shadow_z_far = 1.0f; // UNORM16 的量化范围
+    std::vector<float> shadow_buffer;      // FLOAT32
+    std::vector<uint16_t> shadow_unorm;    // UNORM16；末尾多留一个元素，AVX2 按 32 位 gather 时不越界
+    void alloc_shadow_buffer();
+    const uint16_t* shadow_unorm_data() const { return shadow_format == DepthFormat::UNORM16 ? shadow_unorm.data() : nullptr; }
+
+    // --- Tile 分箱 ---
+    // 每个 tile 独占自己那块 z_buffer / frame_buffer，并行时不需要加锁
+    // 箱子里按提交顺序存三角形下标，保证半透明混合顺序不变
+    int tiles_x, tiles_y;
+    std::vector<RasterTriangle> tri_queue;
+    std::vector<std::vector<uint32_t>> tile_bins;
+    std::vector<cv::Mat> frame_textures; // 本批次用到的贴图 (持有引用，防止调用方的 Mat 先析构)
+
+    int shadow_tiles_x = 0, shadow_tiles_y = 0;
+    std::vector<ShadowTriangle> shadow_queue;
+    std::vector<std::vector<uint32_t>> shadow_bins;
+
+    std::unique_ptr<ThreadPool> pool;
+
+    void flush_shadow();
+    // pass = FORWARD 正常着色；VISIBILITY 只写深度和编号 vis_id；DEFERRED 只写深度和 G-buffer
+    void draw_triangle(const RasterTriangle& t, int x0, int y0, int x1, int y1, ShadingMode pass = ShadingMode::FORWARD, int vis_id = -1);
+    void resolve_visibility(int x0, int y0, int x1, int y1);
+    void light_gbuffer(int x0, int y0, int x1, int y1);
+
+    // 光栅化内核 (RasterKernel.h)：V = float 为标量版本，V = Simd::F8 为 AVX2 版本
+    // S 是编译期的着色器变体 (材质组合)，draw_triangle_variant 按三角形的材质选一个；Msaa 同样在编译期分开
+    template <class V, class S, bool Msaa> void draw_triangle_lanes(const RasterTriangle& t, int x0, int y0, int x1, int y1, ShadingMode pass, int vis_id);
+    template <class V> void draw_triangle_variant(const RasterTriangle& t, int x0, int y0, int x1, int y1, ShadingMode pass, int vis_id);
+    template <class V> void resolve_visibility_lanes(int x0, int y0, int x1, int y1);
+    template <class V> void light_gbuffer_lanes(int x0, int y0, int x1, int y1);
+    void draw_triangle_avx2(const RasterTriangle& t, int x0, int y0, int x1, int y1, ShadingMode pass, int vis_id);
+    void resolve_visibility_avx2(int x0, int y0, int x1, int y1);
+    void light_gbuffer_avx2(int x0, int y0, int x1, int y1);
+    bool use_avx2 = false;
+    bool fixed_point = true;
+    CullMode cull_mode = CullMode::NONE;
+    void draw_shadow_triangle(const ShadowTriangle& t, int x0, int y0, int x1, int y1);
 
     // 画点 (统一用 int)
     void set_pixel(int x, int y, const Vector3i& color);
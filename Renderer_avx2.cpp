@@ -0,0 +1,15 @@
+﻿// AVX2 版本的光栅化内核。
+// 这个文件单独用 -mavx2 -mfma (/arch:AVX2) 编译，Renderer 在运行时检测到 CPU 支持才会调用。
+#include "RasterKernel.h"
+
+void Renderer::draw_triangle_avx2(const RasterTriangle& t, int x0, int y0, int x1, int y1, ShadingMode pass, int vis_id) {
+    draw_triangle_variant<Simd::F8>(t, x0, y0, x1, y1, pass, vis_id);
+}
+
+void Renderer::resolve_visibility_avx2(int x0, int y0, int x1, int y1) {
+    resolve_visibility_lanes<Simd::F8>(x0, y0, x1, y1);
+}
+
+void Renderer::light_gbuffer_avx2(int x0, int y0, int x1, int y1) {
+    light_gbuffer_lanes<Simd::F8>(x0, y0, x1, y1);
+}
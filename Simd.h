@@ -0,0 +1,165 @@
+﻿#pragma once
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// 光栅化 / 顶点内核用的 "通道" 类型：
+//   float / bool / int       -> 标量版本，一次 1 个像素 (任何 CPU 都能跑)
+//   F8 / M8 / I8 (AVX2)      -> 一次 8 个像素，只在 *_avx2.cpp 里编译
+// 内核写成模板，同一份代码分别实例化成两种宽度。
+// 注意：这里的函数全部是 static inline，避免 AVX2 编译单元里生成的版本
+// 在链接时顶替掉标量版本 (否则不支持 AVX2 的 CPU 会崩)。
+namespace Simd {
+
+    // 运行时检测 CPU 是否支持 AVX2 + FMA (还要确认操作系统会保存 YMM 寄存器)
+    static inline bool cpu_has_avx2() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        int info[4];
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool fma = (info[2] & (1 << 12)) != 0;
+        if (!osxsave || !fma) return false;
+        if ((_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+        return false;
+#endif
+    }
+
+    template <class V> struct Lanes;
+
+    // ================= 标量 (1 路) =================
+    template <> struct Lanes<float> {
+        using M = bool;
+        using I = int;
+        static const int width = 1;
+        static float ramp() { return 0.0f; }
+        static int ramp_i() { return 0; }
+        static bool first(int count) { return count > 0; }
+    };
+
+    static inline float vmin(float a, float b) { return a < b ? a : b; }
+    static inline float vmax(float a, float b) { return a > b ? a : b; }
+    static inline float vsqrt(float a) { return std::sqrt(a); }
+    static inline float vfloor(float a) { return std::floor(a); }
+    static inline float select(bool m, float a, float b) { return m ? a : b; }
+    static inline bool any(bool m) { return m; }
+    static inline int bits(bool m) { return m ? 1 : 0; }
+    static inline int to_int(float v) { return (int)v; } // 向 0 截断，和 (int) 强转一致
+    static inline float to_float(int v) { return (float)v; }
+    static inline int shr(int v, int n) { return (int)((unsigned)v >> n); } // 逻辑右移 (拆打包的颜色)
+    static inline bool is_zero(int v) { return v == 0; }
+    static inline bool is_nonneg(int v) { return v >= 0; }
+
+    static inline float load(const float* p, bool m) { return m ? *p : 0.0f; }
+    static inline void store(float* p, bool m, float v) { if (m) *p = v; }
+    static inline void store(int* p, bool m, int v) { if (m) *p = v; }
+    static inline int load(const int* p, bool m) { return m ? *p : 0; }
+    static inline float gather(const float* base, int idx, bool m) { return m ? base[idx] : 0.0f; }
+    static inline float gather(const uint16_t* base, int idx, bool m) { return m ? (float)base[idx] : 0.0f; }
+
+    // 逐通道进出 (贴图采样、写颜色这种没法向量化的部分)
+    static inline void to_lanes(float v, float* out) { out[0] = v; }
+    static inline void to_lanes(int v, int* out) { out[0] = v; }
+    template <class V> static inline V from_lanes(const float* in);
+    template <> inline float from_lanes<float>(const float* in) { return in[0]; }
+
+#if defined(__AVX2__)
+    // ================= AVX2 (8 路) =================
+    struct F8 {
+        __m256 v;
+        F8() {}
+        F8(__m256 x) : v(x) {}
+        F8(float s) : v(_mm256_set1_ps(s)) {}
+    };
+    struct M8 {
+        __m256 v;
+        M8() {}
+        M8(__m256 x) : v(x) {}
+    };
+    struct I8 {
+        __m256i v;
+        I8() {}
+        I8(__m256i x) : v(x) {}
+        I8(int s) : v(_mm256_set1_epi32(s)) {}
+    };
+
+    template <> struct Lanes<F8> {
+        using M = M8;
+        using I = I8;
+        static const int width = 8;
+        static F8 ramp() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+        static I8 ramp_i() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+        // 前 count 个通道有效 (行尾不足 8 个像素时)
+        static M8 first(int count) {
+            __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(count), idx));
+        }
+    };
+
+    static inline F8 operator+(F8 a, F8 b) { return _mm256_add_ps(a.v, b.v); }
+    static inline F8 operator-(F8 a, F8 b) { return _mm256_sub_ps(a.v, b.v); }
+    static inline F8 operator*(F8 a, F8 b) { return _mm256_mul_ps(a.v, b.v); }
+    static inline F8 operator/(F8 a, F8 b) { return _mm256_div_ps(a.v, b.v); }
+    static inline F8& operator+=(F8& a, F8 b) { a.v = _mm256_add_ps(a.v, b.v); return a; }
+    static inline F8& operator*=(F8& a, F8 b) { a.v = _mm256_mul_ps(a.v, b.v); return a; }
+
+    static inline M8 operator<(F8 a, F8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    static inline M8 operator<=(F8 a, F8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+    static inline M8 operator>(F8 a, F8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    static inline M8 operator>=(F8 a, F8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+
+    static inline M8 operator&(M8 a, M8 b) { return _mm256_and_ps(a.v, b.v); }
+    static inline M8 operator|(M8 a, M8 b) { return _mm256_or_ps(a.v, b.v); }
+    static inline M8& operator&=(M8& a, M8 b) { a.v = _mm256_and_ps(a.v, b.v); return a; }
+    static inline M8 operator!(M8 a) { return _mm256_xor_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1))); }
+
+    static inline I8 operator+(I8 a, I8 b) { return _mm256_add_epi32(a.v, b.v); }
+    static inline I8& operator+=(I8& a, I8 b) { a.v = _mm256_add_epi32(a.v, b.v); return a; }
+    static inline I8 operator*(I8 a, I8 b) { return _mm256_mullo_epi32(a.v, b.v); }
+    static inline I8 operator&(I8 a, I8 b) { return _mm256_and_si256(a.v, b.v); }
+    static inline I8 operator|(I8 a, I8 b) { return _mm256_or_si256(a.v, b.v); }
+    static inline I8 operator<<(I8 a, int n) { return _mm256_slli_epi32(a.v, n); }
+
+    static inline F8 vmin(F8 a, F8 b) { return _mm256_min_ps(a.v, b.v); }
+    static inline F8 vmax(F8 a, F8 b) { return _mm256_max_ps(a.v, b.v); }
+    static inline F8 vsqrt(F8 a) { return _mm256_sqrt_ps(a.v); }
+    static inline F8 vfloor(F8 a) { return _mm256_floor_ps(a.v); }
+    static inline F8 select(M8 m, F8 a, F8 b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+    static inline bool any(M8 m) { return _mm256_movemask_ps(m.v) != 0; }
+    static inline int bits(M8 m) { return _mm256_movemask_ps(m.v); }
+    static inline I8 to_int(F8 v) { return _mm256_cvttps_epi32(v.v); }
+    static inline F8 to_float(I8 v) { return _mm256_cvtepi32_ps(v.v); }
+    static inline I8 shr(I8 v, int n) { return _mm256_srli_epi32(v.v, n); }
+    static inline M8 is_zero(I8 v) { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(v.v, _mm256_setzero_si256())); }
+    static inline M8 is_nonneg(I8 v) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(v.v, _mm256_set1_epi32(-1))); }
+
+    // 掩码之外的通道不会访问内存 (行尾越界也安全)
+    static inline F8 load(const float* p, M8 m) { return _mm256_maskload_ps(p, _mm256_castps_si256(m.v)); }
+    static inline void store(float* p, M8 m, F8 v) { _mm256_maskstore_ps(p, _mm256_castps_si256(m.v), v.v); }
+    static inline void store(int* p, M8 m, I8 v) { _mm256_maskstore_epi32(p, _mm256_castps_si256(m.v), v.v); }
+    static inline I8 load(const int* p, M8 m) { return _mm256_maskload_epi32(p, _mm256_castps_si256(m.v)); }
+    static inline F8 gather(const float* base, I8 idx, M8 m) {
+        return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, idx.v, m.v, 4);
+    }
+    // 没有 16 位 gather：按 2 字节步长取 32 位再截掉高半 (会多读后面一个元素，缓冲末尾要多留一个)
+    static inline F8 gather(const uint16_t* base, I8 idx, M8 m) {
+        __m256i raw = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)base, idx.v, _mm256_castps_si256(m.v), 2);
+        return _mm256_cvtepi32_ps(_mm256_and_si256(raw, _mm256_set1_epi32(0xFFFF)));
+    }
+
+    static inline void to_lanes(F8 v, float* out) { _mm256_storeu_ps(out, v.v); }
+    static inline void to_lanes(I8 v, int* out) { _mm256_storeu_si256((__m256i*)out, v.v); }
+    template <> inline F8 from_lanes<F8>(const float* in) { return _mm256_loadu_ps(in); }
+#endif
+
+}
@@ -0,0 +1,32 @@
+﻿#pragma once
+#include <atomic>
+#include <cstddef>
+
+// 单生产者 / 单消费者的无锁环形队列，最多同时存 N - 1 个元素
+// 只能有一个线程 push、一个线程 pop；满 / 空时立即返回 false，不阻塞
+// head 和 tail 放在不同的缓存行上，两个线程各写各的，不会互相抢缓存行
+template <class T, size_t N>
+class SpscQueue {
+public:
+    bool push(const T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % N;
+        if (next == head.load(std::memory_order_acquire)) return false; // 满
+        items[t] = value;
+        tail.store(next, std::memory_order_release); // 发布：消费者看到新 tail 时 items[t] 一定已经写好
+        return true;
+    }
+
+    bool pop(T& out) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false; // 空
+        out = items[h];
+        head.store((h + 1) % N, std::memory_order_release); // 归还槽位给生产者
+        return true;
+    }
+
+private:
+    T items[N];
+    alignas(64) std::atomic<size_t> head{ 0 }; // 消费者写
+    alignas(64) std::atomic<size_t> tail{ 0 }; // 生产者写
+};
@@ -0,0 +1,96 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 简单线程池：parallel_for 把 [0, count) 的任务动态分给所有线程 (调用线程也参与干活)
+class ThreadPool {
+public:
+    // num_threads <= 0 时使用全部硬件线程
+    explicit ThreadPool(int num_threads = 0) {
+        if (num_threads <= 0) num_threads = (int)std::thread::hardware_concurrency();
+        if (num_threads <= 0) num_threads = 1;
+        // 调用线程自己算一个，所以只需要再开 num_threads - 1 个
+        for (int i = 1; i < num_threads; i++) {
+            workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv_start.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return (int)workers.size() + 1; }
+
+    // 阻塞直到所有任务完成
+    void parallel_for(int count, const std::function<void(int)>& fn) {
+        if (workers.empty() || count <= 1) {
+            for (int i = 0; i < count; i++) fn(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            job = &fn;
+            job_count = count;
+            next_task.store(0);
+            busy = (int)workers.size();
+            generation++;
+        }
+        cv_start.notify_all();
+
+        run_tasks();
+
+        std::unique_lock<std::mutex> lock(mtx);
+        cv_done.wait(lock, [this] { return busy == 0; });
+        job = nullptr;
+    }
+
+private:
+    void run_tasks() {
+        for (int i = next_task.fetch_add(1); i < job_count; i = next_task.fetch_add(1)) {
+            (*job)(i);
+        }
+    }
+
+    void worker_loop() {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv_start.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+
+            run_tasks();
+
+            std::lock_guard<std::mutex> lock(mtx);
+            if (--busy == 0) cv_done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable cv_start;
+    std::condition_variable cv_done;
+
+    const std::function<void(int)>* job = nullptr;
+    int job_count = 0;
+    std::atomic<int> next_task{ 0 };
+    int busy = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
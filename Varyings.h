@@ -0,0 +1,21 @@
+﻿#pragma once
+#include <Eigen/Dense>
+
+using namespace Eigen;
+
+// 顶点着色器输出的插值量 (varyings)，按槽位排成一个 float 数组 (SoA 的一列)。
+// 三角形建立时每个槽位算一次平面方程 f(x, y) = dx * x + dy * y + c (透视校正时对 varying / w)，逐像素插值只剩一次乘加；
+// 要加新的插值量，在这里加一个槽位即可，裁剪、光栅化接口都不用改。
+enum Varying {
+    VAR_U, VAR_V,                   // 贴图坐标
+    VAR_NX, VAR_NY, VAR_NZ,         // 法线
+    VAR_SX, VAR_SY, VAR_SZ, VAR_SW, // 光源裁剪空间坐标 (阴影查表时逐像素再做透视除法)
+    VARYING_COUNT
+};
+
+// 顶点着色器的输出
+struct VertexOut {
+    Vector3f pos;       // 屏幕坐标：x, y 为像素 (y 轴向下)，z 为 NDC 深度
+    float inv_w = 1.0f; // 1 / 裁剪空间 w，透视校正插值用 (保持 1 就是屏幕空间线性插值)
+    float varying[VARYING_COUNT];
+};
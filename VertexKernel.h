@@ -0,0 +1,57 @@
+﻿#pragma once
+// 顶点阶段内核 (模板)。
+// V = float 时是标量版本 (VertexStage.cpp)，V = Simd::F8 时是 AVX2 8 顶点版本 (VertexStage_avx2.cpp)。
+// 每次从 SoA 输入里取 W 个连续的顶点，三次矩阵乘法 + 透视除法 + 法线归一化都在向量寄存器里做完再整段写回
+#include "VertexStage.h"
+#include "Simd.h"
+
+// 放在匿名命名空间里：两个编译单元用的指令集不同，不能让链接器把它们合并成一份
+namespace {
+
+// 行优先的 4x4 矩阵乘 (x, y, z, 1)
+template <class V>
+inline void transform_point(const float* m, V x, V y, V z, V& ox, V& oy, V& oz, V& ow) {
+    ox = V(m[0]) * x + V(m[1]) * y + V(m[2]) * z + V(m[3]);
+    oy = V(m[4]) * x + V(m[5]) * y + V(m[6]) * z + V(m[7]);
+    oz = V(m[8]) * x + V(m[9]) * y + V(m[10]) * z + V(m[11]);
+    ow = V(m[12]) * x + V(m[13]) * y + V(m[14]) * z + V(m[15]);
+}
+
+}
+
+template <class V>
+void VertexStage::transform_lanes(const Constants& c) {
+    using namespace Simd;
+    const int W = Lanes<V>::width;
+    const V one(1.0f), half(0.5f), zero(0.0f);
+
+    for (size_t i = 0; i < padded; i += W) {
+        // 1. 原始坐标 (自动缩放已经折进矩阵里)
+        V x = from_lanes<V>(&in.x[i]), y = from_lanes<V>(&in.y[i]), z = from_lanes<V>(&in.z[i]);
+
+        // 2. 主画面裁剪空间 (透视除法和视口变换留到裁剪之后)
+        V cx, cy, cz, cw;
+        transform_point(c.camera_mvp, x, y, z, cx, cy, cz, cw);
+        to_lanes(cx, &out.cx[i]); to_lanes(cy, &out.cy[i]); to_lanes(cz, &out.cz[i]); to_lanes(cw, &out.cw[i]);
+
+        // 3. 光源裁剪空间：主画面原样插值查阴影；阴影 pass 是正交投影不用裁剪，直接做完视口变换
+        V sx, sy, sz, sw;
+        transform_point(c.light_mvp, x, y, z, sx, sy, sz, sw);
+        to_lanes(sx, &out.sx[i]); to_lanes(sy, &out.sy[i]); to_lanes(sz, &out.sz[i]); to_lanes(sw, &out.sw[i]);
+        to_lanes(V(c.shadow_half_w) * (sx / sw + one), &out.lx[i]);
+        to_lanes(V(c.shadow_half_h) * (one - sy / sw), &out.ly[i]); // y 轴向下，和主画面一致
+        to_lanes(sz / sw * half + half, &out.lz[i]);                 // NDC [-1,1] -> [0,1]
+
+        // 4. 法线转到世界空间再归一化 (长度为 0 的保持原样)
+        V nx = from_lanes<V>(&in.nx[i]), ny = from_lanes<V>(&in.ny[i]), nz = from_lanes<V>(&in.nz[i]);
+        V wx = V(c.normal[0]) * nx + V(c.normal[1]) * ny + V(c.normal[2]) * nz;
+        V wy = V(c.normal[3]) * nx + V(c.normal[4]) * ny + V(c.normal[5]) * nz;
+        V wz = V(c.normal[6]) * nx + V(c.normal[7]) * ny + V(c.normal[8]) * nz;
+        V len2 = wx * wx + wy * wy + wz * wz;
+        typename Lanes<V>::M valid = len2 > zero;
+        V len = vsqrt(len2);
+        to_lanes(select(valid, wx / len, wx), &out.nx[i]);
+        to_lanes(select(valid, wy / len, wy), &out.ny[i]);
+        to_lanes(select(valid, wz / len, wz), &out.nz[i]);
+    }
+}
@@ -0,0 +1,55 @@
+﻿#include "VertexStage.h"
+#include "VertexKernel.h"
+
+VertexStage::VertexStage(const LoadModel::SubMesh& mesh) {
+    const size_t n = mesh.vertices.size();
+    padded = (n + LANE_PAD - 1) / LANE_PAD * LANE_PAD;
+
+    // 补齐的部分填 0，算出来的结果没人读
+    for (auto* plane : { &in.x, &in.y, &in.z, &in.nx, &in.ny, &in.nz, &in.u, &in.v }) {
+        plane->assign(padded, 0.0f);
+    }
+    for (size_t i = 0; i < n; i++) {
+        in.x[i] = mesh.vertices[i].x(); in.y[i] = mesh.vertices[i].y(); in.z[i] = mesh.vertices[i].z();
+        in.nx[i] = mesh.normals[i].x(); in.ny[i] = mesh.normals[i].y(); in.nz[i] = mesh.normals[i].z();
+        in.u[i] = mesh.texcoords[i].x(); in.v[i] = mesh.texcoords[i].y();
+    }
+
+    for (auto* plane : { &out.cx, &out.cy, &out.cz, &out.cw, &out.nx, &out.ny, &out.nz,
+                         &out.sx, &out.sy, &out.sz, &out.sw, &out.lx, &out.ly, &out.lz }) {
+        plane->assign(padded, 0.0f);
+    }
+
+    set_simd_enabled(true);
+}
+
+void VertexStage::set_simd_enabled(bool enabled) {
+#ifdef SR_AVX2_KERNEL
+    use_avx2 = enabled && Simd::cpu_has_avx2();
+#else
+    use_avx2 = false;
+#endif
+}
+
+void VertexStage::run(const VertexUniforms& u) {
+    Constants c;
+    for (int r = 0; r < 4; r++) {
+        for (int k = 0; k < 4; k++) {
+            c.camera_mvp[r * 4 + k] = u.camera_mvp(r, k);
+            c.light_mvp[r * 4 + k] = u.light_mvp(r, k);
+        }
+    }
+    for (int r = 0; r < 3; r++) {
+        for (int k = 0; k < 3; k++) c.normal[r * 3 + k] = u.normal_matrix(r, k);
+    }
+    c.shadow_half_w = 0.5f * u.shadow_width;
+    c.shadow_half_h = 0.5f * u.shadow_height;
+
+#ifdef SR_AVX2_KERNEL
+    if (use_avx2) {
+        transform_avx2(c);
+        return;
+    }
+#endif
+    transform_lanes<float>(c);
+}
@@ -0,0 +1,72 @@
+﻿#pragma once
+#include <Eigen/Dense>
+#include <vector>
+#include <cstdint>
+#include "LoadModel.h"
+#include "Clipper.h"
+
+using namespace Eigen;
+
+// 每帧都一样的顶点着色器参数
+struct VertexUniforms {
+    Matrix4f camera_mvp;         // 模型矩阵里已经包含自动缩放 (Model::normalization)
+    Matrix4f light_mvp;
+    Matrix4f normal_matrix;      // 只用左上 3x3 (法线只受旋转影响)
+    int shadow_width = 1, shadow_height = 1;
+};
+
+// 顶点阶段：一个 SubMesh 的所有顶点一次变换完，结果存进 post-transform 缓冲，
+// 阴影 pass 和主画面都按索引从这里取，不再逐个角点、逐个 pass 重复做矩阵乘法。
+// 输入输出都是 SoA (每个分量一个数组)，AVX2 时一次 8 个顶点；数组长度补齐到 8 的倍数，内核不处理尾巴
+class VertexStage {
+public:
+    static const int LANE_PAD = 8;
+
+    // 位置、法线、UV 拆成 SoA，只在加载后做一次
+    explicit VertexStage(const LoadModel::SubMesh& mesh);
+
+    // 变换所有顶点，覆盖上一帧的输出
+    void run(const VertexUniforms& u);
+
+    // 是否使用 AVX2 版本 (CPU 不支持时始终走标量版本)
+    void set_simd_enabled(bool enabled);
+
+    // 阴影图屏幕坐标 (x, y 为像素，y 轴向下；z 映射到 [0,1])
+    Vector3f light_screen(uint32_t i) const { return Vector3f(out.lx[i], out.ly[i], out.lz[i]); }
+
+    // 主画面：裁剪空间坐标 + varyings，直接交给 Clipper
+    void clip_vertex(uint32_t i, Clipper::Vertex& v) const {
+        v.clip = Vector4f(out.cx[i], out.cy[i], out.cz[i], out.cw[i]);
+        v.varying[VAR_U] = in.u[i]; v.varying[VAR_V] = in.v[i];
+        v.varying[VAR_NX] = out.nx[i]; v.varying[VAR_NY] = out.ny[i]; v.varying[VAR_NZ] = out.nz[i];
+        v.varying[VAR_SX] = out.sx[i]; v.varying[VAR_SY] = out.sy[i]; v.varying[VAR_SZ] = out.sz[i]; v.varying[VAR_SW] = out.sw[i];
+    }
+
+private:
+    size_t padded; // 补齐后的顶点数
+
+    struct Input {
+        std::vector<float> x, y, z;
+        std::vector<float> nx, ny, nz;
+        std::vector<float> u, v;       // 原样传给 varyings，不参与计算
+    } in;
+
+    struct Output {
+        std::vector<float> cx, cy, cz, cw;   // 主画面裁剪空间
+        std::vector<float> nx, ny, nz;       // 世界空间单位法线
+        std::vector<float> sx, sy, sz, sw;   // 光源裁剪空间 (主画面查阴影用)
+        std::vector<float> lx, ly, lz;       // 阴影图屏幕坐标 (阴影 pass 用，和上面同一次矩阵乘法算出来)
+    } out;
+
+    // 矩阵展开成 float 交给内核 (内核里不碰 Eigen，两个编译单元不共享任何内联函数)
+    struct Constants {
+        float camera_mvp[16], light_mvp[16]; // 行优先
+        float normal[9];                     // 行优先 3x3
+        float shadow_half_w, shadow_half_h;
+    };
+
+    // 顶点内核 (VertexKernel.h)：V = float 为标量版本，V = Simd::F8 为 AVX2 版本
+    template <class V> void transform_lanes(const Constants& c);
+    void transform_avx2(const Constants& c);
+    bool use_avx2 = false;
+};
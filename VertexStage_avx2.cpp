@@ -0,0 +1,7 @@
+﻿// AVX2 版本的顶点内核。
+// 这个文件单独用 -mavx2 -mfma (/arch:AVX2) 编译，VertexStage 在运行时检测到 CPU 支持才会调用。
+#include "VertexKernel.h"
+
+void VertexStage::transform_avx2(const Constants& c) {
+    transform_lanes<Simd::F8>(c);
+}
@@ -5,10 +5,15 @@
 #include <limits>
 #include <filesystem> 
 #include <cmath> // 需要这个算 cos/sin
+#include <atomic>
+#include <thread>
 
 #include "Renderer.h"
 #include "LoadModel.h"
 #include "MathUtils.h"
+#include "Clipper.h"
+#include "SpscQueue.h"
+#include "VertexStage.h"
 #include <Eigen/Dense>
 #include <opencv2/opencv.hpp>
 
@@ -22,6 +27,9 @@ using namespace MathUtils;
 const int WIDTH = 700;
 const int HEIGHT = 700;
 
+// 单面材质的剔除方式 (OBJ 默认逆时针为正面；模型是顺时针绕序时改成 CullMode::FRONT)
+const CullMode SINGLE_SIDED_CULL = CullMode::BACK;
+
 // ==========================================
 // 🟢 1. 鼠标交互状态管理
 // ==========================================
@@ -37,11 +45,13 @@ struct MouseState {
     float angle_x = 0.0f;
     float angle_y = 0.0f;
     int scroll_delta = 0;
+    bool changed = false; // 回调改过状态，显示线程据此决定要不要发给渲染线程
 };
 
 // 鼠标回调函数
 void onMouse(int event, int x, int y, int flags, void* userdata) {
     MouseState* state = (MouseState*)userdata;
+    state->changed = true;
 
     if (event == EVENT_LBUTTONDOWN) {
         state->left_down = true;
@@ -86,6 +96,12 @@ void onMouse(int event, int x, int y, int flags, void* userdata) {
     }
 }
 
+// 显示线程 -> 渲染线程的输入：一次按键 (-1 = 没有) + 当时的鼠标状态快照
+struct InputEvent {
+    int key;
+    MouseState mouse;
+};
+
 int main(int argc, char** argv) {
     // 1. 获取路径
     std::string obj_path;
@@ -130,34 +146,13 @@ int main(int argc, char** argv) {
         }
     }
 
-    // 4. 自动缩放逻辑
-    float min_x = std::numeric_limits<float>::max(); float max_x = std::numeric_limits<float>::lowest();
-    float min_y = std::numeric_limits<float>::max(); float max_y = std::numeric_limits<float>::lowest();
-    float min_z = std::numeric_limits<float>::max(); float max_z = std::numeric_limits<float>::lowest();
-
-    for (const auto& mesh : my_model.meshes) {
-        for (const auto& v : mesh.vertices) {
-            min_x = std::min(min_x, v.x()); max_x = std::max(max_x, v.x());
-            min_y = std::min(min_y, v.y()); max_y = std::max(max_y, v.y());
-            min_z = std::min(min_z, v.z()); max_z = std::max(max_z, v.z());
-        }
-    }
-
-    float center_x = (min_x + max_x) / 2.0f;
-    float center_y = (min_y + max_y) / 2.0f;
-    float center_z = (min_z + max_z) / 2.0f;
-
-    float max_dim = std::max({ max_x - min_x, max_y - min_y, max_z - min_z });
-    float target_size = 10.0f;
-    float scale = target_size / max_dim;
-
     // 初始化渲染器
     Renderer rst(WIDTH, HEIGHT);
+    rst.set_msaa_enabled(true); // 4x MSAA，轮廓边缘抗锯齿
+    rst.set_transparency_mode(TransparencyMode::SORTED); // 眼镜等半透明件每帧按深度排序，从远到近混合
 
-    // 🟢 初始化交互状态
+    // 🟢 初始化交互状态 (渲染线程这边的副本，由显示线程发来的 InputEvent 更新)
     MouseState mouse_state;
-    namedWindow("LuckyStar Renderer", WINDOW_AUTOSIZE);
-    setMouseCallback("LuckyStar Renderer", onMouse, &mouse_state);
 
     // 相机与灯光变量
     Vector3f camera_pos(0.0f, 0.0f, 20.0f);
@@ -166,7 +161,10 @@ int main(int argc, char** argv) {
     float cam_yaw = 0.0f;
 
     Vector3f light_pos(20.0f, 20.0f, 20.0f);
-    rst.init_shadow_buffer(1024, 1024);
+    // 光源的正交投影每帧都一样；UNORM16 阴影图按它近 / 远平面经过下面同样的深度变换 (z * 0.5 + 0.5) 之后的值量化
+    const Matrix4f l_proj = MathUtils::get_ortho_matrix(-30, 30, -30, 30, 0.1f, 100.0f);
+    auto light_depth = [&](float view_z) { return (l_proj(2, 2) * view_z + l_proj(2, 3)) * 0.5f + 0.5f; };
+    rst.init_shadow_buffer(1024, 1024, DepthFormat::UNORM16, light_depth(-0.1f), light_depth(-100.0f));
 
     // =============================================================
     // 🟢 初始化天空盒 (支持单张全景图)
@@ -178,30 +176,87 @@ int main(int argc, char** argv) {
     sky_path = clean_path(sky_path);
     if (!sky_path.empty()) skybox.load(sky_path);
 
+    // =============================================================
+    // 🟢 三缓冲 + 异步显示
+    // =============================================================
+    // 渲染器手里一块 (正在画 N+1)，显示线程手里一块 (正在显示 N)，再加一块空闲/待显示的。
+    // 缓冲在两个无锁队列之间流转，只交换指针：渲染线程画完一帧换一块空闲的进来，把画好的交给显示线程；
+    // 显示线程拿到新的一帧就把上一块还回去。渲染不再等 imshow / waitKey，帧率只受渲染时间限制
+    const int SPARE_FRAMES = 2;
+    std::vector<std::vector<uint32_t>> frame_ring(SPARE_FRAMES, std::vector<uint32_t>((size_t)WIDTH * HEIGHT));
+    SpscQueue<std::vector<uint32_t>*, SPARE_FRAMES + 1> free_frames;  // 显示线程 -> 渲染线程
+    SpscQueue<std::vector<uint32_t>*, SPARE_FRAMES + 1> ready_frames; // 渲染线程 -> 显示线程
+    for (auto& buffer : frame_ring) free_frames.push(&buffer);
+    SpscQueue<InputEvent, 64> input_events;                           // 显示线程 -> 渲染线程
+    std::atomic<bool> quit{ false };
+
+    // 显示线程：窗口的创建、鼠标回调、imshow 和 waitKey 都在这一个线程里 (HighGUI 要求同一个线程)
+    std::thread presenter([&] {
+        MouseState mouse;
+        namedWindow("LuckyStar Renderer", WINDOW_AUTOSIZE);
+        setMouseCallback("LuckyStar Renderer", onMouse, &mouse);
+
+        std::vector<uint32_t>* shown = nullptr;
+        while (!quit.load(std::memory_order_relaxed)) {
+            // 只显示最新的一帧，来不及显示的直接还回去
+            std::vector<uint32_t>* frame;
+            bool fresh = false;
+            while (ready_frames.pop(frame)) {
+                if (shown) free_frames.push(shown);
+                shown = frame;
+                fresh = true;
+            }
+            if (fresh) imshow("LuckyStar Renderer", Mat(HEIGHT, WIDTH, CV_8UC4, shown->data()));
+
+            // 轮询输入 (鼠标回调也在这里面触发)
+            // 队列满 (渲染线程很久没来取) 时这次按键丢掉，鼠标的改动留到下一轮再发
+            int key = waitKey(1);
+            if (key != -1 || mouse.changed) {
+                if (input_events.push({ key, mouse })) {
+                    mouse.changed = false;
+                    mouse.scroll_delta = 0;
+                }
+            }
+        }
+    });
+
+    // 顶点阶段：每个部件一份 SoA 输入和 post-transform 缓冲，每帧整体变换一次，三角形按下标取用
+    std::vector<VertexStage> vertex_stages;
+    for (const auto& mesh : my_model.meshes) vertex_stages.emplace_back(mesh);
+
     while (true) {
         Vector3f target_pos(0.0f, 3.0f, 0.0f);
         rst.clear(skybox, camera_pos, target_pos);
 
-        // --- 1. 处理键盘输入 (控制相机) ---
-        int key = waitKey(10);
+        // --- 1. 处理输入 (控制相机)：上一帧以来显示线程收到的所有按键和最新的鼠标状态 ---
         float move_speed = 0.5f;
         float rot_speed = 2.0f;
-
-        // 相机移动 (WASDQE)
-        if (key == 'e') camera_pos.y() += move_speed;
-        if (key == 'q') camera_pos.y() -= move_speed;
-        if (key == 'a') camera_pos.x() -= move_speed;
-        if (key == 'd') camera_pos.x() += move_speed;
-        if (key == 'w') camera_pos.z() -= move_speed;
-        if (key == 's') camera_pos.z() += move_speed;
-
-        // 相机旋转 (IJKL) - 模拟摇头和点头
-        if (key == 'i') cam_pitch += rot_speed;
-        if (key == 'k') cam_pitch -= rot_speed;
-        if (key == 'j') cam_yaw += rot_speed;
-        if (key == 'l') cam_yaw -= rot_speed;
-
-        if (key == 27) break; // ESC 退出
+        bool exit_requested = false;
+        InputEvent input;
+        while (input_events.pop(input)) {
+            int key = input.key;
+
+            // 相机移动 (WASDQE)
+            if (key == 'e') camera_pos.y() += move_speed;
+            if (key == 'q') camera_pos.y() -= move_speed;
+            if (key == 'a') camera_pos.x() -= move_speed;
+            if (key == 'd') camera_pos.x() += move_speed;
+            if (key == 'w') camera_pos.z() -= move_speed;
+            if (key == 's') camera_pos.z() += move_speed;
+
+            // 相机旋转 (IJKL) - 模拟摇头和点头
+            if (key == 'i') cam_pitch += rot_speed;
+            if (key == 'k') cam_pitch -= rot_speed;
+            if (key == 'j') cam_yaw += rot_speed;
+            if (key == 'l') cam_yaw -= rot_speed;
+
+            if (key == 27) exit_requested = true; // ESC 退出
+
+            int scroll = mouse_state.scroll_delta + input.mouse.scroll_delta;
+            mouse_state = input.mouse;
+            mouse_state.scroll_delta = scroll;
+        }
+        if (exit_requested) break;
 
         if (mouse_state.scroll_delta != 0) {
             float zoom_speed = 0.05f;
@@ -222,6 +277,7 @@ int main(int argc, char** argv) {
         model_trans(2, 3) = 0.0f; // 鼠标只控制平面移动
         // 组合: 先旋转再位移
         Matrix4f model = model_trans * model_rot;
+        Matrix4f model_fit = model * my_model.normalization; // 自动缩放 (加载时算好) 放在最右边，先于旋转生效
         Matrix4f normal_matrix = model_rot; // 法线只受旋转影响
 
         // 🟢 B. 计算 View 矩阵 (由键盘控制)
@@ -240,15 +296,25 @@ int main(int argc, char** argv) {
 
         // D. Light 矩阵
         Matrix4f l_view = MathUtils::get_view_matrix(light_pos);
-        Matrix4f l_proj = MathUtils::get_ortho_matrix(-30, 30, -30, 30, 0.1f, 100.0f);
-        Matrix4f light_mvp = l_proj * l_view * model;
+        Matrix4f light_mvp = l_proj * l_view * model_fit;
+
+        // E. 顶点阶段：所有部件的顶点一次变换完 (SIMD)，阴影 pass 和主画面都读这份结果
+        VertexUniforms uniforms;
+        uniforms.camera_mvp = proj * view * model_fit;
+        uniforms.light_mvp = light_mvp;
+        uniforms.normal_matrix = normal_matrix;
+        uniforms.shadow_width = SHADOW_WIDTH;   // 🟢 使用全局变量 SHADOW_WIDTH，不要写死 1024
+        uniforms.shadow_height = SHADOW_HEIGHT;
+        for (auto& stage : vertex_stages) stage.run(uniforms);
 
         // =========================================================
         // Pass 1: Shadow Map
         // =========================================================
         rst.clear_shadow();
 
-        for (const auto& mesh : my_model.meshes) {
+        for (size_t m = 0; m < my_model.meshes.size(); m++) {
+            const auto& mesh = my_model.meshes[m];
+            const VertexStage& stage = vertex_stages[m];
             std::string tex_path = "";
             if (mesh.texture_id >= 0 && mesh.texture_id < my_model.texture_paths.size()) {
                 tex_path = my_model.texture_paths[mesh.texture_id];
@@ -259,23 +325,13 @@ int main(int argc, char** argv) {
             if (tex_path.find("megane") != std::string::npos ||
                 tex_path.find("glass") != std::string::npos) continue;
 
-            for (int i = 0; i < mesh.vertices.size(); i += 3) {
-                Vector3f p_light[3];
-                for (int j = 0; j < 3; j++) {
-                    Vector3f v_local = (mesh.vertices[i + j] - Vector3f(center_x, center_y, center_z)) * scale;
+            // 闭合的单面部件背对光源的一半三角形不影响阴影图 (最近的一定是正面)
+            rst.set_cull_mode(mesh.double_sided ? CullMode::NONE : SINGLE_SIDED_CULL);
 
-                    Vector4f v_clip = light_mvp * Vector4f(v_local.x(), v_local.y(), v_local.z(), 1.0f);
-                    Vector3f v_ndc = v_clip.head<3>() / v_clip.w();
-
-                    // 🟢【修改 1】使用全局变量 SHADOW_WIDTH，不要写死 1024
-                    p_light[j].x() = 0.5f * SHADOW_WIDTH * (v_ndc.x() + 1.0f);
-                    p_light[j].y() = 0.5f * SHADOW_HEIGHT * (v_ndc.y() + 1.0f);
-
-                    // 🟢【修改 2】将 Z 值从 NDC[-1,1] 映射到 [0,1]
-                    // 这能让深度值的分布更合理，减少 Z-Fighting 带来的锯齿和斑点
-                    p_light[j].z() = v_ndc.z() * 0.5f + 0.5f;
-                }
-                rst.rasterize_shadow(p_light[0], p_light[1], p_light[2]);
+            // 阴影图坐标在顶点阶段已经做完视口变换，z 从 NDC [-1,1] 映射到 [0,1] (深度分布更合理，减少 Z-Fighting)
+            for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+                rst.rasterize_shadow(stage.light_screen(mesh.indices[i]), stage.light_screen(mesh.indices[i + 1]),
+                    stage.light_screen(mesh.indices[i + 2]));
             }
         }
 
@@ -305,7 +361,8 @@ int main(int argc, char** argv) {
         int grid_size = 20;       // 网格范围 (-20 到 20)
         float grid_step = 1.0f;   // 每一格多大 (1.0 米)
 
-        float floor_level = (min_y - center_y) * scale;
+        // 地板贴着模型缩放后的最低点
+        float floor_level = (my_model.normalization * my_model.aabb_min.homogeneous()).y();
 
         Scalar grid_color(180, 180, 180); // 浅灰色 (BGR)
         Scalar axis_color(100, 100, 100); // 深灰色 (中心线)
@@ -364,8 +421,9 @@ int main(int argc, char** argv) {
         // =========================================================
         // Pass 2.2: 画人物实体 (Alpha=1.0)
         // =========================================================
-		camera_mvp = proj * view * model;
-        for (const auto& mesh : my_model.meshes) {
+        for (size_t m = 0; m < my_model.meshes.size(); m++) {
+            const auto& mesh = my_model.meshes[m];
+            const VertexStage& stage = vertex_stages[m];
             cv::Mat current_texture = default_tex;
             if (mesh.texture_id >= 0 && mesh.texture_id < texture_library.size()) {
                 current_texture = texture_library[mesh.texture_id];
@@ -377,35 +435,43 @@ int main(int argc, char** argv) {
             }
             std::transform(tex_path.begin(), tex_path.end(), tex_path.begin(), ::tolower);
 
+            // 眼镜 / 玻璃：半透明，不写深度，不透明物体画完后按平均 w 基数排序、从远到近混合 (阴影 pass 里仍然跳过，不投影)
             bool is_glass = (tex_path.find("megane") != std::string::npos) ||
                 (tex_path.find("glass") != std::string::npos);
-            if (is_glass) continue;
+            float alpha = is_glass ? 0.35f : 1.0f;
+
+            // 背面剔除：双面材质 (头发、裙子) 两面都画
+            rst.set_cull_mode(mesh.double_sided ? CullMode::NONE : SINGLE_SIDED_CULL);
 
-            for (int i = 0; i < mesh.vertices.size(); i += 3) {
-                Vector3f v[3] = { mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2] };
-                Vector2f uv[3] = { mesh.texcoords[i], mesh.texcoords[i + 1], mesh.texcoords[i + 2] };
-                Vector3f n[3] = { mesh.normals[i], mesh.normals[i + 1], mesh.normals[i + 2] };
-                Vector3f p_screen[3]; Vector3f n_trans[3]; Vector4f p_shadow[3];
+            for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+                Clipper::Vertex clip_in[3], clip_out[Clipper::MAX_VERTS];
+                for (int j = 0; j < 3; j++) stage.clip_vertex(mesh.indices[i + j], clip_in[j]);
 
-                for (int j = 0; j < 3; j++) {
-                    Vector3f v_local = (v[j] - Vector3f(center_x, center_y, center_z)) * scale;
+                // 视锥剔除 + 近平面裁剪 (离得很近时不会再出现 w <= 0 的顶点)
+                int clip_count = Clipper::clip_triangle(clip_in, clip_out);
+                if (clip_count == 0) continue;
 
-                    Vector4f v_clip = camera_mvp * Vector4f(v_local.x(), v_local.y(), v_local.z(), 1.0f);
+                VertexOut screen[Clipper::MAX_VERTS];
+                for (int j = 0; j < clip_count; j++) {
+                    const Vector4f& v_clip = clip_out[j].clip;
                     Vector3f v_ndc = v_clip.head<3>() / v_clip.w();
-                    p_screen[j].x() = 0.5f * WIDTH * (v_ndc.x() + 1.0f);
-                    p_screen[j].y() = 0.5f * HEIGHT * (v_ndc.y() + 1.0f);
-                    p_screen[j].z() = v_ndc.z();
+                    screen[j].pos.x() = 0.5f * WIDTH * (v_ndc.x() + 1.0f);
+                    screen[j].pos.y() = 0.5f * HEIGHT * (1.0f - v_ndc.y()); // 视口变换时翻转 y，第 0 行在最上面
+                    screen[j].pos.z() = v_ndc.z();
+                    screen[j].inv_w = 1.0f / v_clip.w(); // 透视校正插值
+                    std::copy(clip_out[j].varying, clip_out[j].varying + VARYING_COUNT, screen[j].varying);
+                }
 
-                    Vector4f n_temp = normal_matrix * Vector4f(n[j].x(), n[j].y(), n[j].z(), 0.0f);
-                    n_trans[j] = n_temp.head<3>().normalized();
-                    p_shadow[j] = light_mvp * Vector4f(v_local.x(), v_local.y(), v_local.z(), 1.0f);
+                // 裁剪后的凸多边形按扇形拆成三角形
+                for (int j = 1; j + 1 < clip_count; j++) {
+                    rst.rasterize_triangle(screen[0], screen[j], screen[j + 1],
+                        current_texture, mesh.is_face, alpha);
                 }
-                rst.rasterize_triangle(p_screen[0], p_screen[1], p_screen[2],
-                    uv[0], uv[1], uv[2], n_trans[0], n_trans[1], n_trans[2],
-                    p_shadow[0], p_shadow[1], p_shadow[2],
-                    current_texture, mesh.is_face, 1.0f);
             }
         }
+        // 上面只是分箱，这里才按 tile 多线程真正光栅化 (阴影图 + 主画面)
+        rst.flush();
+
         // =========================================================
         // 后期处理 (描边)
         // =========================================================
@@ -414,45 +480,68 @@ int main(int argc, char** argv) {
         float bg_depth = 4000.0f;
         float edge_threshold = 0.001f;
 
-        for (int y = 0; y < HEIGHT - 1; y++) {
-            int z_y = HEIGHT - 1 - y;
-            for (int x = 0; x < WIDTH - 1; x++) {
-                int idx = z_y * WIDTH + x;
-                float z_center = z_buf[idx];
-                if (z_center > bg_depth) continue;
-
-                int idx_right = z_y * WIDTH + (x + 1);
-                int z_y_down = z_y - 1;
-                if (z_y_down < 0) z_y_down = 0;
-                int idx_down = z_y_down * WIDTH + x;
-
-                float z_right = z_buf[idx_right];
-                float z_down = z_buf[idx_down];
-
-                float diff = 0.0f;
-                bool is_silhouette = false;
-                if (z_right > bg_depth || z_down > bg_depth) {
-                    diff = 100.0f;
-                    is_silhouette = true;
+        // 按 8x8 块走，先看块的深度范围 (右边、下边的邻居可能落在相邻块里，一起算上)：
+        // 整块都是背景，或者深度起伏小到两个差值加起来也超不过阈值，这块就不可能有描边，整块跳过
+        const int B = Renderer::BLOCK_SIZE;
+        for (int by = 0; by < HEIGHT - 1; by += B) {
+            for (int bx = 0; bx < WIDTH - 1; bx += B) {
+                float z_min, z_max, n_min, n_max;
+                rst.get_block_depth_range(bx / B, by / B, z_min, z_max);
+                if (z_min > bg_depth) continue;
+                if (bx + B < WIDTH) {
+                    rst.get_block_depth_range(bx / B + 1, by / B, n_min, n_max);
+                    z_min = std::min(z_min, n_min); z_max = std::max(z_max, n_max);
                 }
-                else {
-                    float dx = std::abs(z_center - z_right);
-                    float dy = std::abs(z_center - z_down);
-                    diff = dx + dy;
+                if (by + B < HEIGHT) {
+                    rst.get_block_depth_range(bx / B, by / B + 1, n_min, n_max);
+                    z_min = std::min(z_min, n_min); z_max = std::max(z_max, n_max);
                 }
-
-                if (diff > edge_threshold) {
-                    frame.at<cv::Vec3b>(y, x) = cv::Vec3b(0, 0, 0);
-                    if (is_silhouette) {
-                        frame.at<cv::Vec3b>(y, x + 1) = cv::Vec3b(0, 0, 0);
-                        frame.at<cv::Vec3b>(y + 1, x) = cv::Vec3b(0, 0, 0);
+                if (z_max <= bg_depth && 2.0f * (z_max - z_min) <= edge_threshold) continue;
+
+                for (int y = by; y < std::min(by + B, HEIGHT - 1); y++) {
+                    for (int x = bx; x < std::min(bx + B, WIDTH - 1); x++) {
+                        int idx = y * WIDTH + x;
+                        float z_center = z_buf[idx];
+                        if (z_center > bg_depth) continue;
+
+                        int idx_right = y * WIDTH + (x + 1);
+                        int idx_down = (y + 1) * WIDTH + x;
+
+                        float z_right = z_buf[idx_right];
+                        float z_down = z_buf[idx_down];
+
+                        float diff = 0.0f;
+                        bool is_silhouette = false;
+                        if (z_right > bg_depth || z_down > bg_depth) {
+                            diff = 100.0f;
+                            is_silhouette = true;
+                        }
+                        else {
+                            float dx = std::abs(z_center - z_right);
+                            float dy = std::abs(z_center - z_down);
+                            diff = dx + dy;
+                        }
+
+                        if (diff > edge_threshold) {
+                            frame.at<cv::Vec4b>(y, x) = cv::Vec4b(0, 0, 0, 255);
+                            if (is_silhouette) {
+                                frame.at<cv::Vec4b>(y, x + 1) = cv::Vec4b(0, 0, 0, 255);
+                                frame.at<cv::Vec4b>(y + 1, x) = cv::Vec4b(0, 0, 0, 255);
+                            }
+                        }
                     }
                 }
             }
         }
 
-        imshow("LuckyStar Renderer", frame);
+        // 换一块空闲缓冲进来画下一帧，画好的这块交给显示线程 (显示线程还没还回来时让出 CPU 等一下)
+        std::vector<uint32_t>* spare;
+        while (!free_frames.pop(spare)) std::this_thread::yield();
+        rst.swap_color_buffer(*spare);
+        ready_frames.push(spare);
     }
 
+    quit.store(true);
+    presenter.join();
     return 0;
 }
\ No newline at end of file